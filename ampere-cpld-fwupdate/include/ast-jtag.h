@@ -49,6 +49,7 @@
  * @JTAG_STATE_PAUSEIR: JTAG state machine PAUSE_IR state
  * @JTAG_STATE_EXIT2IR: JTAG state machine EXIT-2 IR state
  * @JTAG_STATE_UPDATEIR: JTAG state machine UPDATE IR state
+ * @JTAG_STATE_CURRENT: JTAG current state, used as xfer start state
  */
 enum jtag_endstate {
 	JTAG_STATE_TLRESET,
@@ -66,7 +67,8 @@ enum jtag_endstate {
 	JTAG_STATE_EXIT1IR,
 	JTAG_STATE_PAUSEIR,
 	JTAG_STATE_EXIT2IR,
-	JTAG_STATE_UPDATEIR
+	JTAG_STATE_UPDATEIR,
+	JTAG_STATE_CURRENT
 };
 
 /**
@@ -146,6 +148,30 @@ struct jtag_xfer {
 	u64	tdio;
 };
 
+/**
+ * struct jtag_xfer_buf - jtag xfer with data buffer:
+ *
+ * @type: transfer type
+ * @direction: xfer direction
+ * @from: xfer start state
+ * @endstate: xfer end state
+ * @padding: padding
+ * @length: xfer bits len
+ * @tdio: user pointer to xfer data array of length bits
+ *
+ * Structure of the newer JTAG uAPI, where tdio points to a buffer instead
+ * of holding the data, so an SDR of any width is a single ioctl.
+ */
+struct jtag_xfer_buf {
+	unsigned char	type;
+	unsigned char	direction;
+	unsigned char	from;
+	unsigned char	endstate;
+	unsigned int	padding;
+	unsigned int	length;
+	u64	tdio;
+};
+
 /**
  * struct jtag_bitbang - jtag bitbang:
  *
@@ -177,6 +203,70 @@ struct jtag_mode {
 	unsigned int	mode;
 };
 
+/**
+ * enum jtag_scan_op_type:
+ *
+ * @JTAG_SCAN_SIR: queued SIR transfer
+ * @JTAG_SCAN_SDR: queued SDR transfer
+ * @JTAG_SCAN_RUNTEST: queued RUNTEST IDLE clocks and minimum wait
+ */
+enum jtag_scan_op_type {
+	JTAG_SCAN_SIR = JTAG_SIR_XFER,
+	JTAG_SCAN_SDR = JTAG_SDR_XFER,
+	JTAG_SCAN_RUNTEST = 2,
+};
+
+/**
+ * struct jtag_scan_op - queued jtag scan operation:
+ *
+ * @type: operation type (enum jtag_scan_op_type)
+ * @direction: xfer direction for SIR/SDR
+ * @end: 0 - end in IDLE, 1 - end in PAUSE
+ * @len: xfer bits len for SIR/SDR, TCK count for RUNTEST
+ * @usec: minimum time spent in IDLE for RUNTEST
+ * @ir: SIR data, kept in the queue so callers need no storage for it
+ * @tdio: SDR data array, owned by the caller and updated on flush
+ *
+ * Operations are collected by the ast_jtag_queue_* helpers and run in
+ * order by ast_jtag_queue_flush(), one driver call per SIR/SDR.
+ */
+struct jtag_scan_op {
+	unsigned char	type;
+	unsigned char	direction;
+	unsigned char	end;
+	unsigned int	len;
+	unsigned int	usec;
+	u32	ir;
+	u32	*tdio;
+};
+
+/**
+ * struct jtag_chain - padding around the target device on a daisy chain:
+ *
+ * @hir: IR bits of the devices between the target and TDO
+ * @tir: IR bits of the devices between TDI and the target
+ * @hdr: devices between the target and TDO, one BYPASS bit each
+ * @tdr: devices between TDI and the target, one BYPASS bit each
+ *
+ * Every SIR/SDR is extended by the header and trailer bits in the same
+ * controller xfer, IR padding is all ones so the other devices sit in
+ * BYPASS.
+ */
+struct jtag_chain {
+	unsigned int	hir;
+	unsigned int	tir;
+	unsigned int	hdr;
+	unsigned int	tdr;
+};
+
+#define JTAG_SCAN_QUEUE_DEPTH	64
+
+/* devices ast_jtag_chain_scan() looks for */
+#define JTAG_CHAIN_MAX		8
+
+/* TCKs per JTAG_SIOCSTATE, struct jtag_end_tap_state.tck is 8 bits */
+#define JTAG_STATE_TCK_MAX	255
+
 /* ioctl interface */
 #define __JTAG_IOCTL_MAGIC	0xb2
 
@@ -184,6 +274,7 @@ struct jtag_mode {
 #define JTAG_SIOCFREQ	_IOW(__JTAG_IOCTL_MAGIC, 1, unsigned int)
 #define JTAG_GIOCFREQ	_IOR(__JTAG_IOCTL_MAGIC, 2, unsigned int)
 #define JTAG_IOCXFER	_IOWR(__JTAG_IOCTL_MAGIC, 3, struct jtag_xfer)
+#define JTAG_IOCXFER_BUF	_IOWR(__JTAG_IOCTL_MAGIC, 3, struct jtag_xfer_buf)
 #define JTAG_GIOCSTATUS _IOWR(__JTAG_IOCTL_MAGIC, 4, enum jtag_endstate)
 #define JTAG_SIOCMODE	_IOW(__JTAG_IOCTL_MAGIC, 5, unsigned int)
 #define JTAG_IOCBITBANG	_IOW(__JTAG_IOCTL_MAGIC, 6, unsigned int)
@@ -197,8 +288,21 @@ int ast_set_mode(unsigned int mode);
 int ast_jtag_run_test_idle(unsigned char reset, unsigned char end, unsigned char tck);
 int ast_jtag_sir_xfer(unsigned char endir, unsigned int len,
                                u32 *tdi, u32 *tdo);
+int ast_jtag_sdr_xfer(unsigned char direct, unsigned char enddr, unsigned int len, u32 *tdio);
 int ast_jtag_tdo_xfer(unsigned char enddr, unsigned int len, u32 *tdio);
 int ast_jtag_tdi_xfer(unsigned char enddr, unsigned int len, u32 *tdio);
 int ast_jtag_xfer(unsigned char type, unsigned char direct,
                   unsigned char end, unsigned int len, u32 *tdio);
 void jtag_runtest_idle(unsigned int tcks, unsigned int min_mSec);
+int ast_jtag_set_tap_state(unsigned char reset, unsigned char endstate);
+int ast_jtag_queue_sir(unsigned char endir, unsigned int len, u32 tdi);
+int ast_jtag_queue_sdr(unsigned char direct, unsigned char enddr,
+		       unsigned int len, u32 *tdio);
+int ast_jtag_queue_tdi(unsigned char enddr, unsigned int len, u32 *tdio);
+int ast_jtag_queue_tdo(unsigned char enddr, unsigned int len, u32 *tdio);
+int ast_jtag_queue_runtest(unsigned int tcks, unsigned int usec);
+int ast_jtag_queue_flush(void);
+void ast_jtag_set_chain(const struct jtag_chain *chain);
+int ast_jtag_chain_scan(u32 *idcode, int max);
+void jtag_bits_copy(u32 *dst, unsigned int dst_pos, const u32 *src,
+		    unsigned int src_pos, unsigned int len);
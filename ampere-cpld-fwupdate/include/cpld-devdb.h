@@ -0,0 +1,23 @@
+/*
+ * Device database
+ *
+ * The devices the tool knows, looked up by IDCODE or by the JEDEC device
+ * name: the MachXO2 and MachXO3LF flash parts are built in, --devdb adds
+ * or overrides entries from a text file, one device per line:
+ *
+ *   # part         idcode      rows  ufm  dr_bits  erase   erase_max  prog  prog_max  [done  refresh]
+ *   LCMXO2-4000HC  0x012BC043  5758  767  128      1000000 3500000    200   31000
+ *
+ * The IDCODE is hex, 0x optional, times are in us. An IDCODE that is
+ * already known takes the geometry and timing of the line, a new one is
+ * added with the MachXO2 flow.
+ */
+
+/* entries, built in and loaded */
+#define CPLD_DEV_MAX		64
+
+extern struct cpld_dev_info lattice_device_list[CPLD_DEV_MAX];
+
+struct cpld_dev_info *cpld_dev_lookup(unsigned int idcode);
+struct cpld_dev_info *cpld_dev_lookup_part(const char *device);
+int cpld_devdb_load(const char *path);
@@ -0,0 +1,86 @@
+/*
+ * Update instrumentation
+ *
+ * Every job thread keeps a struct cpld_stats next to its struct jtag_stats:
+ * wall time per phase, how many LSC_CHECK_BUSY polls each busy wait took
+ * and the slowest CFG rows. With --stats both are printed at the end of
+ * the run, as text or as JSON for a rollout orchestrator.
+ */
+
+/* phases, cpld_phase_names[] */
+#define CPLD_PHASE_NONE		0	/* not timed */
+#define CPLD_PHASE_OPEN		1	/* controller, chain and IDCODE */
+#define CPLD_PHASE_FREQ		2	/* --auto-freq */
+#define CPLD_PHASE_PARSE	3	/* image load */
+#define CPLD_PHASE_CHECK	4	/* -k and -R device checks */
+#define CPLD_PHASE_ERASE	5
+#define CPLD_PHASE_PROGRAM	6	/* CFG rows */
+#define CPLD_PHASE_FINISH	7	/* USERCODE, DONE, exit programming */
+#define CPLD_PHASE_VERIFY	8
+#define CPLD_PHASE_READ		9
+#define CPLD_PHASE_REFRESH	10
+#define CPLD_PHASE_MAX		11
+
+/* busy wait histogram buckets: 1, 2, 3-4, 5-8, ... polls, the last open */
+#define CPLD_BUSY_HIST		8
+
+/* slowest rows kept */
+#define CPLD_SLOW_ROWS		8
+
+/**
+ * struct cpld_slow_row - one programmed row:
+ *
+ * @row: row number
+ * @us: shift to ready, in us
+ * @polls: LSC_CHECK_BUSY polls
+ */
+struct cpld_slow_row {
+	unsigned int	row;
+	unsigned int	us;
+	unsigned int	polls;
+};
+
+/**
+ * struct cpld_stats - instrumentation of one job:
+ *
+ * @phase: phase being timed
+ * @phase_start: CLOCK_MONOTONIC us @phase started at
+ * @phase_us: time spent per phase
+ * @busy_waits: busy waits
+ * @busy_polls: polls of all @busy_waits
+ * @busy_hist: @busy_waits by poll count, bucket n up to 2^n polls
+ * @rows: rows programmed
+ * @slow: slowest rows, slowest first
+ * @nslow: entries in @slow
+ * @erase_us: flash erase, ISC_ERASE to ready, 0 if none
+ * @erase_predict_us: what the erase was expected to take
+ * @erase_polls: LSC_CHECK_BUSY polls of the erase
+ * @erase_bound: @erase_us is an upper bound, the first poll found it done
+ */
+struct cpld_stats {
+	int			phase;
+	unsigned long long	phase_start;
+	unsigned long long	phase_us[CPLD_PHASE_MAX];
+	unsigned int		busy_waits;
+	unsigned long long	busy_polls;
+	unsigned int		busy_hist[CPLD_BUSY_HIST];
+	unsigned int		rows;
+	struct cpld_slow_row	slow[CPLD_SLOW_ROWS];
+	unsigned int		nslow;
+	unsigned int		erase_us;
+	unsigned int		erase_predict_us;
+	unsigned int		erase_polls;
+	int			erase_bound;
+};
+
+extern __thread struct cpld_stats cpld_stats;
+
+unsigned long long cpld_time_us(void);
+void cpld_stats_reset(void);
+void cpld_stats_phase(int phase);
+void cpld_stats_busy(unsigned int polls);
+void cpld_stats_row(unsigned int row, unsigned int us, unsigned int polls);
+void cpld_stats_erase(unsigned int us, unsigned int predict_us, unsigned int polls, int bound);
+void cpld_stats_text(FILE *fp, const struct cpld_stats *s, const struct jtag_stats *js);
+void cpld_json_string(FILE *fp, const char *s);
+void cpld_stats_json(FILE *fp, const struct cpld_stats *s, const struct jtag_stats *js);
@@ -0,0 +1,8 @@
+/*
+ * CRC-32 (IEEE 802.3, reflected 0xEDB88320)
+ *
+ * crc32_update(0, buf, len) gives the CRC of buf; pass the previous result
+ * back in to continue over more data. Slice-by-8 tables, 8 bytes per step.
+ */
+
+u32 crc32_update(u32 crc, const void *buf, size_t len);
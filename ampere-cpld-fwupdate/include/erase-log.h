@@ -0,0 +1,39 @@
+/*
+ * Erase time log
+ *
+ * Every flash erase is timed and kept per JTAG node and IDCODE in
+ * CPLD_ERASE_LOG: how many erases, a running average and the shortest,
+ * longest and last erase. The average is what the next erase of that
+ * device is expected to take, and a rising average or maximum over the
+ * months is the flash wearing out.
+ *
+ * Only an erase that was seen busy at least once is measured. One that
+ * was already done at the first poll is counted apart, the time of that
+ * poll kept as an upper bound until the next measured erase.
+ */
+
+#define CPLD_ERASE_LOG		CPLD_STATE_DIR "/erase-log"
+
+/**
+ * struct cpld_erase_log - erase history of one device:
+ *
+ * @count: erases timed
+ * @avg_us: running average, the last erase weighted 1/8
+ * @min_us: shortest erase
+ * @max_us: longest erase
+ * @last_us: latest erase
+ * @bounds: erases done before the first poll
+ * @bound_us: the erase took at most this, 0 when measured since
+ */
+struct cpld_erase_log {
+	unsigned int	count;
+	unsigned int	avg_us;
+	unsigned int	min_us;
+	unsigned int	max_us;
+	unsigned int	last_us;
+	unsigned int	bounds;
+	unsigned int	bound_us;
+};
+
+int cpld_erase_log_get(const char *node, u32 idcode, struct cpld_erase_log *log);
+int cpld_erase_log_put(const char *node, u32 idcode, unsigned int us, int measured);
@@ -0,0 +1,13 @@
+/*
+ * ASCII fuse string packing
+ *
+ * JEDEC fuse data is a string of '0'/'1' characters broken into lines.
+ * jed_pack_fuses() turns it into packed bits, first fuse in bit 0 of the
+ * first u32, 16/32/64 characters per step with SSE2, NEON or 64-bit words.
+ * jed_row_cmp() compares packed rows with the same vector width.
+ */
+
+size_t jed_pack_fuses(const char *src, size_t len, u32 *dst,
+		      unsigned int *pos, unsigned int max, u32 *sum);
+int jed_row_cmp(const u32 *a, const u32 *b, unsigned int words);
+const char *jed_pack_kernel(void);
@@ -0,0 +1,52 @@
+/*
+ * Compressed image input
+ *
+ * jed_input_open() looks at the first bytes of a file and reads it as is,
+ * or through gzip, xz or zstd decompression when the file starts with one
+ * of their magics and the decoder was built in (HAVE_ZLIB, HAVE_LZMA,
+ * HAVE_ZSTD). JEDEC files and pre-compiled images go straight from the
+ * decoder into the parser, no temporary file. jed_input_peek() returns the
+ * first decompressed bytes without consuming them, to tell a JEDEC file
+ * from a pre-compiled image.
+ */
+
+#define JED_INPUT_PLAIN		0
+#define JED_INPUT_GZIP		1
+#define JED_INPUT_XZ		2
+#define JED_INPUT_ZSTD		3
+
+/* compressed bytes read from the file at a time */
+#define JED_INPUT_CHUNK		16384
+#define JED_INPUT_PEEK		16
+
+/**
+ * struct jed_input - image file and its decoder:
+ *
+ * @fd: image file
+ * @format: JED_INPUT_*
+ * @dec: decoder state, NULL for a plain file
+ * @buf: compressed input, JED_INPUT_CHUNK bytes
+ * @eof: the file is read to its end
+ * @end: the decoder reached the end of the compressed data
+ * @peek: decompressed bytes returned by jed_input_peek()
+ * @peek_len: bytes in @peek
+ * @peek_pos: bytes of @peek already returned by jed_input_read()
+ */
+struct jed_input {
+	int		fd;
+	int		format;
+	void		*dec;
+	u8		*buf;
+	int		eof;
+	int		end;
+	u8		peek[JED_INPUT_PEEK];
+	size_t		peek_len;
+	size_t		peek_pos;
+};
+
+int jed_input_open(struct jed_input *in, const char *path);
+ssize_t jed_input_peek(struct jed_input *in, void *buf, size_t len);
+ssize_t jed_input_read(struct jed_input *in, void *buf, size_t len);
+ssize_t jed_input_read_full(struct jed_input *in, void *buf, size_t len);
+void jed_input_close(struct jed_input *in);
+const char *jed_input_name(int format);
@@ -0,0 +1,64 @@
+/*
+ * Pipelined JEDEC decode
+ *
+ * jed_stream_open() first decodes the whole image and drops the rows, so
+ * a bad checksum, CRC-32 or fuse list fails before the device is erased.
+ * It then starts a decoder thread that reads, and decompresses if need be,
+ * the image again and packs its CFG fuses into a ring of JED_STREAM_ROWS
+ * row buffers, while the JTAG thread takes the rows in order with
+ * jed_stream_next() and gives each back with jed_stream_release() once it
+ * is shifted. Only the ring and one read chunk are held, and the parse
+ * runs while the device programs the rows before. The second pass must
+ * find the CRC-32 of the first; its result is known after the last row,
+ * from jed_stream_close().
+ */
+
+#define JED_STREAM_ROWS		16
+#define JED_STREAM_CHUNK	16384
+
+/**
+ * struct jed_stream - decoder thread and row ring:
+ *
+ * @jed: parse result, jed->stream points back here
+ * @parser: JEDEC parser in row mode
+ * @in: image file, decompressed if need be
+ * @image: a pre-compiled image, rows are read as they are
+ * @image_crc: CRC-32 from the image header
+ * @words: u32 per row
+ * @ring: JED_STREAM_ROWS rows
+ * @head: rows put into the ring
+ * @tail: rows released by the JTAG thread
+ * @done: the decoder thread is finished
+ * @abort: the JTAG thread gave up, the decoder stops at the next row
+ * @status: decoder result, 0 or -1
+ * @check: the check pass before the erase, rows are dropped
+ * @check_crc: CRC-32 the check pass found
+ * @lock: guards @head, @tail, @done and @abort
+ * @cond: a row was put or released, or the decoder finished
+ * @thread: decoder thread
+ */
+struct jed_stream {
+	struct jed_file		*jed;
+	struct jed_parser	parser;
+	struct jed_input	in;
+	int			image;
+	u32			image_crc;
+	unsigned int		words;
+	u32			*ring;
+	unsigned int		head;
+	unsigned int		tail;
+	int			done;
+	int			abort;
+	int			status;
+	int			check;
+	u32			check_crc;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	pthread_t		thread;
+};
+
+int jed_stream_open(struct jed_stream *s, const char *path, struct jed_file *jed,
+		    unsigned short dr_bits);
+u32 *jed_stream_next(struct jed_stream *s);
+void jed_stream_release(struct jed_stream *s);
+int jed_stream_close(struct jed_stream *s);
@@ -0,0 +1,192 @@
+/*
+ * JEDEC fuse file parser
+ *
+ * The whole file is read in one pass: every '*' terminated field is looked
+ * at once, config fuses are packed as they are seen and the notes that
+ * carry the config size and user code are picked up on the way. Fuses no
+ * L field lists take the F field default, fuse lists must come in address
+ * order. The fuse checksum and the CRC-32 of the fuse map are run along, a
+ * checksum that does not match the C field fails the parse.
+ */
+
+#define JED_FIELD_MAX		256
+#define JED_MAX_SECTIONS	16
+#define JED_DEVICE_MAX		32
+
+struct jed_stream;
+
+/*
+ * Pre-compiled fuse image: a cpld_image_header followed by the packed CFG
+ * fuse map exactly as struct jed_file holds it, little endian.
+ */
+#define CPLD_IMAGE_MAGIC	0x49444C43	/* "CLDI" */
+#define CPLD_IMAGE_VERSION	1
+
+/**
+ * struct cpld_image_header - pre-compiled fuse image header:
+ *
+ * @magic: CPLD_IMAGE_MAGIC
+ * @version: CPLD_IMAGE_VERSION
+ * @header_size: bytes before the fuse map
+ * @dev_id: IDCODE of the target device
+ * @usercode: usercode to program
+ * @row_num: CFG rows
+ * @dr_bits: bits per row
+ * @flags: reserved, 0
+ * @cfg_bits: CFG fuses in the fuse map
+ * @crc32: CRC-32 of the first (cfg_bits + 7) / 8 bytes of the fuse map
+ */
+struct cpld_image_header {
+	u32	magic;
+	u16	version;
+	u16	header_size;
+	u32	dev_id;
+	u32	usercode;
+	u32	row_num;
+	u16	dr_bits;
+	u16	flags;
+	u32	cfg_bits;
+	u32	crc32;
+} __attribute__((__packed__));
+
+/**
+ * struct jed_section - one L (fuse list) field:
+ *
+ * @addr: fuse address of the first fuse in the field
+ * @bits: fuses in the field
+ * @offset: file offset of the first fuse character
+ */
+struct jed_section {
+	unsigned int	addr;
+	unsigned int	bits;
+	size_t		offset;
+};
+
+/**
+ * struct jed_file - parsed JEDEC file:
+ *
+ * @cfg_bits: CFG data bit size, the L address following "END CONFIG DATA"
+ * @usercode: "UH" user electronic signature
+ * @fuse: packed CFG fuse map, 32 fuses per word, first fuse in bit 0
+ * @fuse_bits: fuses packed into @fuse
+ * @fuse_words: allocated words of @fuse
+ * @qf_bits: total fuse count from the QF field, 0 if absent
+ * @crc32: CRC-32 of the packed CFG fuse map
+ * @csum: JEDEC fuse checksum over all fuses, unlisted ones at the F default
+ * @file_csum: checksum from the C field
+ * @has_csum: the file has a C field
+ * @dev_id: target IDCODE of a pre-compiled image, 0 for a JEDEC file
+ * @device: device name from the "DEVICE NAME" note
+ * @usercode_offset: file offset of the UH field
+ * @nsections: L fields found
+ * @section: L fields in file order, those before "END CONFIG DATA" hold the
+ *	     CFG data
+ * @stream: CFG rows come from a pipelined decoder, @fuse is not the fuse map
+ */
+struct jed_file {
+	unsigned int	cfg_bits;
+	u32		usercode;
+	u32		*fuse;
+	unsigned int	fuse_bits;
+	unsigned int	fuse_words;
+	unsigned int	qf_bits;
+	u32		crc32;
+	u16		csum;
+	u16		file_csum;
+	int		has_csum;
+	u32		dev_id;
+	char		device[JED_DEVICE_MAX];
+	size_t		usercode_offset;
+	int		nsections;
+	struct jed_section section[JED_MAX_SECTIONS];
+	struct jed_stream *stream;
+};
+
+/**
+ * struct jed_parser - incremental parser state:
+ *
+ * @jed: parse result
+ * @state: position inside the current field
+ * @field: first character of the current field
+ * @text: current non fuse field, truncated to JED_FIELD_MAX - 1
+ * @text_len: characters in @text
+ * @addr: address of the current L field
+ * @cfg_note: the last note was "END CONFIG DATA"
+ * @cfg_end: the L field after "END CONFIG DATA" started, the CFG map is done
+ * @ues_note: the last note was "User Electronic Signature"
+ * @offset: file offset of the next input character
+ * @csum: running fuse checksum
+ * @fuse_default: F field, the value of fuses no L field lists
+ * @next_addr: fuse address after the last fuse listed or defaulted
+ * @crc: running CRC-32 of the CFG fuse map
+ * @crc_bytes: fuse map bytes in @crc
+ * @error: a parse error was reported
+ * @row_fn: if set, called with each packed CFG row as soon as it is
+ *	    complete; the fuse map of @jed then holds the current row only
+ * @row_arg: @row_fn argument
+ * @rows: rows passed to @row_fn
+ */
+struct jed_parser {
+	struct jed_file	*jed;
+	int		state;
+	char		field;
+	char		text[JED_FIELD_MAX];
+	unsigned int	text_len;
+	unsigned int	addr;
+	int		cfg_note;
+	int		cfg_end;
+	int		ues_note;
+	size_t		offset;
+	u32		csum;
+	int		fuse_default;
+	unsigned int	next_addr;
+	u32		crc;
+	size_t		crc_bytes;
+	int		error;
+	int		(*row_fn)(void *arg, const u32 *row);
+	void		*row_arg;
+	unsigned int	rows;
+};
+
+/**
+ * struct jed_writer - readback output, written a batch of rows at a time:
+ *
+ * @fp: output file, @path with ".new" until jed_writer_close()
+ * @path: output file name
+ * @jedec: write a JEDEC file, else a pre-compiled image
+ * @dev_id: IDCODE of the device read
+ * @usercode: USERCODE, set before jed_writer_close()
+ * @rows: CFG rows expected
+ * @dr_bits: bits per row
+ * @row: rows written
+ * @crc: CRC-32 of the rows written
+ * @csum: JEDEC fuse checksum of the rows written
+ * @xsum: JEDEC transmission checksum of the characters written
+ */
+struct jed_writer {
+	FILE		*fp;
+	char		path[256];
+	int		jedec;
+	u32		dev_id;
+	u32		usercode;
+	unsigned int	rows;
+	unsigned short	dr_bits;
+	unsigned int	row;
+	u32		crc;
+	u32		csum;
+	u16		xsum;
+};
+
+void jed_parse_init(struct jed_parser *p, struct jed_file *jed);
+int jed_parse_rows(struct jed_parser *p, unsigned short dr_bits,
+		   int (*row_fn)(void *arg, const u32 *row), void *arg);
+int jed_parse_feed(struct jed_parser *p, const char *buf, size_t len);
+int jed_parse_finish(struct jed_parser *p);
+int jed_file_load(const char *path, struct jed_file *jed);
+void jed_file_free(struct jed_file *jed);
+int jed_image_write(const char *path, struct jed_file *jed, u32 dev_id,
+		    unsigned int row_num, unsigned short dr_bits);
+int jed_writer_open(struct jed_writer *w, const char *path, const char *device,
+		    u32 dev_id, unsigned int rows, unsigned short dr_bits);
+int jed_writer_rows(struct jed_writer *w, const u32 *buf, unsigned int count);
+int jed_writer_close(struct jed_writer *w, int keep);
@@ -0,0 +1,42 @@
+/*
+ * Programming checkpoint journal
+ *
+ * While the CFG rows are programmed, the row up to which the device is
+ * confirmed programmed is kept in a small file per JTAG node, next to the
+ * image it belongs to. An interrupted update can then be picked up with
+ * --resume from that row instead of erasing the device again. The file is
+ * replaced atomically and removed once the device is done.
+ */
+
+#define CPLD_JOURNAL_MAGIC	0x4E524A43	/* "CJRN" */
+#define CPLD_JOURNAL_VERSION	1
+
+/* rows programmed between journal updates */
+#define CPLD_JOURNAL_ROWS	256
+
+/**
+ * struct cpld_journal - programming checkpoint:
+ *
+ * @magic: CPLD_JOURNAL_MAGIC
+ * @version: CPLD_JOURNAL_VERSION
+ * @size: sizeof(struct cpld_journal)
+ * @dev_id: IDCODE of the device being programmed
+ * @image_crc: CRC-32 of the image CFG fuse map
+ * @usercode: image USERCODE
+ * @rows: CFG rows of the image
+ * @next_row: the rows before this one are programmed and out of busy
+ */
+struct cpld_journal {
+	u32	magic;
+	u16	version;
+	u16	size;
+	u32	dev_id;
+	u32	image_crc;
+	u32	usercode;
+	u32	rows;
+	u32	next_row;
+};
+
+int cpld_journal_load(const char *node, struct cpld_journal *j);
+int cpld_journal_save(const char *node, const struct cpld_journal *j);
+void cpld_journal_clear(const char *node);
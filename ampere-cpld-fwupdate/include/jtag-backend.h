@@ -0,0 +1,78 @@
+/*
+ * JTAG controller backends
+ *
+ * The ast_jtag_* library drives the controller through a struct
+ * jtag_backend picked from the node name in ast_jtag_open():
+ *   /dev/jtagN                          Aspeed JTAG driver ioctls
+ *   gpio:<chip>:<tck>,<tms>,<tdi>,<tdo>  GPIO bit-bang through libgpiod
+ *   sim[<n>][:<file>]                   MachXO2 TAP/flash simulator, a chain
+ *                                       of n devices, the flash optionally
+ *                                       kept in <file>
+ */
+
+/* driver call types, jtag_call_names[] */
+#define JTAG_CALL_XFER_BUF	0	/* JTAG_IOCXFER_BUF, a simulator scan */
+#define JTAG_CALL_XFER		1	/* legacy 32-bit JTAG_IOCXFER */
+#define JTAG_CALL_STATE		2	/* JTAG_SIOCSTATE, run-test clocks included */
+#define JTAG_CALL_BITBANG	3	/* JTAG_IOCBITBANG */
+#define JTAG_CALL_FREQ		4	/* JTAG_GIOCFREQ, JTAG_SIOCFREQ */
+#define JTAG_CALL_MODE		5	/* JTAG_SIOCMODE */
+#define JTAG_CALL_GPIO		6	/* GPIO line get/set */
+#define JTAG_CALL_MAX		7
+
+/**
+ * struct jtag_stats - controller traffic since ast_jtag_open():
+ *
+ * @xfers: SIR/SDR xfers
+ * @xfer_bits: bits shifted by @xfers
+ * @sir_xfers: SIR xfers among @xfers
+ * @sir_bits: bits shifted by @sir_xfers
+ * @runtests: RUNTEST IDLE calls
+ * @runtest_tcks: TCKs clocked by @runtests
+ * @calls: driver calls (ioctls, GPIO line operations, simulator steps)
+ * @call: @calls by JTAG_CALL_* type
+ */
+struct jtag_stats {
+	unsigned long long	xfers;
+	unsigned long long	xfer_bits;
+	unsigned long long	sir_xfers;
+	unsigned long long	sir_bits;
+	unsigned long long	runtests;
+	unsigned long long	runtest_tcks;
+	unsigned long long	calls;
+	unsigned long long	call[JTAG_CALL_MAX];
+};
+
+#define JTAG_STATS_CALL(type)	do { jtag_stats.calls++; jtag_stats.call[type]++; } while (0)
+
+/**
+ * struct jtag_backend - controller operations:
+ *
+ * @name: backend name
+ * @open: open the controller, arg is the node name without the prefix
+ * @close: release the controller
+ * @get_freq: TCK frequency in Hz, 0 on error
+ * @set_freq: set the TCK frequency
+ * @set_mode: JTAG_XFER_HW_MODE or JTAG_XFER_SW_MODE
+ * @xfer: shift a SIR/SDR of any length from/to tdio, end 0 - IDLE, 1 - PAUSE
+ * @runtest: clock tcks TCKs in Run-Test/Idle
+ * @set_state: move the TAP to endstate, through Test-Logic-Reset with reset
+ */
+struct jtag_backend {
+	const char	*name;
+	int		(*open)(const char *arg);
+	void		(*close)(void);
+	unsigned int	(*get_freq)(void);
+	int		(*set_freq)(unsigned int freq);
+	int		(*set_mode)(unsigned int mode);
+	int		(*xfer)(unsigned char type, unsigned char direct,
+				unsigned char end, unsigned int len, u32 *tdio);
+	int		(*runtest)(unsigned int tcks);
+	int		(*set_state)(unsigned char reset, unsigned char endstate);
+};
+
+extern const struct jtag_backend jtag_aspeed_backend;
+extern const struct jtag_backend jtag_gpio_backend;
+extern const struct jtag_backend jtag_sim_backend;
+extern __thread struct jtag_stats jtag_stats;
+extern const char *jtag_call_names[JTAG_CALL_MAX];
@@ -0,0 +1,19 @@
+/*
+ * JTAG clock auto-tuning
+ *
+ * jtag_auto_freq() looks for the highest TCK the board runs error free:
+ * starting from the current, known good, frequency it tries max and then
+ * binary searches between the two. Every candidate has to read the
+ * IDCODE back and shift pseudo-random data through BYPASS unchanged for
+ * a number of rounds. The result, less a safety margin, is cached per
+ * node and IDCODE in JTAG_FREQ_CACHE and tried first on the next run.
+ */
+
+#define JTAG_FREQ_CACHE		CPLD_STATE_DIR "/jtag-freq"
+
+#define JTAG_FREQ_MAX		50000000	/* default search limit */
+#define JTAG_FREQ_MARGIN	20		/* percent below the highest good TCK */
+#define JTAG_FREQ_ROUNDS	8		/* probe rounds per candidate */
+#define JTAG_FREQ_STEPS		10		/* binary search steps at most */
+
+int jtag_auto_freq(const char *node, u32 idcode, unsigned int max);
@@ -0,0 +1,106 @@
+/*
+ * JTAG operation trace
+ *
+ * With --record every SIR/SDR, RUNTEST, wait, TAP state move and TCK
+ * frequency change that goes through the ast_jtag layer is appended to a
+ * binary trace: a jtag_trace_header, then one jtag_trace_rec per operation,
+ * each followed by its TDI words when it writes and its TDO words when it
+ * reads. Scans are kept as the tool issued them, before daisy chain
+ * padding. --replay plays a trace through any backend and reports the
+ * throughput, a repeatable benchmark of a real update session.
+ */
+
+#define JTAG_TRACE_MAGIC	0x4352544A	/* "JTRC" */
+#define JTAG_TRACE_VERSION	1
+
+/* jtag_trace_rec.op, SIR/SDR/RUNTEST as enum jtag_scan_op_type */
+#define JTAG_TRACE_SIR		JTAG_SCAN_SIR
+#define JTAG_TRACE_SDR		JTAG_SCAN_SDR
+#define JTAG_TRACE_RUNTEST	JTAG_SCAN_RUNTEST	/* len TCKs */
+#define JTAG_TRACE_WAIT		3	/* len us in Run-Test/Idle */
+#define JTAG_TRACE_STATE	4	/* direct reset, end endstate */
+#define JTAG_TRACE_FREQ		5	/* len Hz */
+#define JTAG_TRACE_OPS		6
+
+/* longest scan a record holds, in 32-bit words */
+#define JTAG_TRACE_WORDS	32768
+
+/* a busy poll that reads other TDO than recorded is repeated for that long */
+#define JTAG_TRACE_RETRY_MAX_US	10000000
+#define JTAG_TRACE_RETRY_US	50
+
+/* TDO mismatches printed by the replay */
+#define JTAG_TRACE_REPORT	8
+
+/**
+ * struct jtag_trace_header - trace file header:
+ *
+ * @magic: JTAG_TRACE_MAGIC
+ * @version: JTAG_TRACE_VERSION
+ * @header_size: bytes before the first record
+ * @freq: TCK frequency when the recording started, Hz
+ * @flags: reserved, 0
+ * @node: JTAG node recorded
+ */
+struct jtag_trace_header {
+	u32	magic;
+	u16	version;
+	u16	header_size;
+	u32	freq;
+	u32	flags;
+	char	node[64];
+} __attribute__((__packed__));
+
+/**
+ * struct jtag_trace_rec - one operation:
+ *
+ * @op: JTAG_TRACE_*
+ * @direct: SIR/SDR JTAG_READ_XFER/JTAG_WRITE_XFER, STATE reset
+ * @end: SIR/SDR/STATE end state
+ * @status: 0, 1 when the operation failed
+ * @len: scan bits, TCKs, us or Hz as of @op
+ * @gap_us: time from the end of the previous record, spent in the tool
+ * @us: time the operation took
+ */
+struct jtag_trace_rec {
+	u8	op;
+	u8	direct;
+	u8	end;
+	u8	status;
+	u32	len;
+	u32	gap_us;
+	u32	us;
+} __attribute__((__packed__));
+
+/**
+ * struct jtag_trace - recording in progress:
+ *
+ * @fp: trace file
+ * @path: trace file name
+ * @rec: record of the operation in progress
+ * @start: CLOCK_MONOTONIC us the operation started at
+ * @last: CLOCK_MONOTONIC us the previous operation ended at
+ * @tdi: TDI words of the operation in progress
+ * @records: records written
+ * @bytes: bytes written
+ * @error: a write failed, the trace is incomplete
+ */
+struct jtag_trace {
+	FILE			*fp;
+	const char		*path;
+	struct jtag_trace_rec	rec;
+	unsigned long long	start;
+	unsigned long long	last;
+	u32			*tdi;
+	unsigned long long	records;
+	unsigned long long	bytes;
+	int			error;
+};
+
+extern __thread struct jtag_trace *jtag_trace;
+
+int jtag_trace_open(const char *path, const char *node, unsigned int freq);
+void jtag_trace_close(void);
+void jtag_trace_begin(u8 op, u8 direct, u8 end, unsigned int len, const u32 *tdi);
+void jtag_trace_end(int retval, const u32 *tdo);
+int jtag_trace_replay(const char *path);
@@ -2,6 +2,9 @@
 
 #define	BYPASS					0xff
 
+//LSC_WRITE_ADDRESS operand: CFG page in the low bits
+#define LATTICE_PAGE_MASK		0x3FFF
+
 //MachXO2 Programming Commands
 #define IDCODE                  0x16
 #define IDCODE_PUB              0xE0
@@ -34,46 +37,62 @@
 #define ISC_PROGRAM_SECPLUS     0xCF
 #define UIDCODE_PUB             0x19
 
+struct jed_file;
+struct jed_writer;
+
+//skip-if-identical check before erase
+#define CPLD_SKIP_NONE			0
+#define CPLD_SKIP_USERCODE		1
+#define CPLD_SKIP_SAMPLE		2
+#define CPLD_SKIP_FULL			3
+
+//cpld_program() result when the device already holds the image
+#define CPLD_UP_TO_DATE			1
+
+//state kept across runs: TCK cache, programming journal
+#define CPLD_STATE_DIR			"/var/lib/ampere-cpld-fwupdate"
+
 /*************************************************************************************/
-/* LATTICE MachXO LCMXO2-4000HC CPLD */
+/* LATTICE MachXO2/MachXO3 CPLD, the flow written for the LCMXO2-4000HC first */
 extern int lcmxo2_4000hc_cpld_erase(void);
-extern int llcmxo2_4000hc_cpld_program(FILE *jed_fd);
-extern int lcmxo2_4000hc_cpld_verify(FILE *jed_fd);
+extern int llcmxo2_4000hc_cpld_program(struct jed_file *jed);
+extern int lcmxo2_4000hc_cpld_verify(struct jed_file *jed);
+extern int lcmxo2_4000hc_cpld_read(struct jed_writer *w);
+extern int lcmxo2_4000hc_cpld_refresh(void);
 /*************************************************************************************/
 
-//--------------------------------------------------
-// Change the string to hex.
-//--------------------------------------------------
-#define BITS_FSM_NONE     0
-#define BITS_FSM_READ     1
-#define BITS_FSM_RESET    2
-#define BITS_FSM_BITS     3
-#define BITS_FSM_PUSH_HighBIT '1'
-#define BITS_FSM_PUSH_ZeroBIT '0'
-#define BITS_FSM_END_MARK '*'
-/*************************************************************************************/
+/**
+ * struct cpld_timing - flash timing of a device, in us:
+ *
+ * @erase: CFG erase, typical
+ * @erase_max: CFG erase, worst case
+ * @prog: row program, typical
+ * @prog_max: row program, worst case
+ * @done: ISC_PROGRAM_DONE, worst case
+ * @refresh: LSC_REFRESH until the device runs the new design
+ */
+struct cpld_timing {
+	unsigned int		erase;
+	unsigned int		erase_max;
+	unsigned int		prog;
+	unsigned int		prog_max;
+	unsigned int		done;
+	unsigned int		refresh;
+};
 
 struct cpld_dev_info {
 	const char		*name;
+	const char		*part;			//JEDEC device name prefix
 	unsigned int 		dev_id;
 	unsigned short		dr_bits;		//col
+	unsigned short		ir_bits;		//IR length on a chain
 	unsigned int		row_num;		//row
+	unsigned int		ufm_rows;		//UFM pages, 0 - none
+	struct cpld_timing	timing;
 	int (*cpld_id)(unsigned int *id);
 	int (*cpld_erase)(void);
-	int (*cpld_program)(FILE *jed_fd);
-	int (*cpld_verify)(FILE *jed_fd);
-};
-
-/*************************************************************************************/
-
-static struct cpld_dev_info lattice_device_list[] = {
-    [0] = {
-		.name = "LATTICE MachXO LCMXO2-4000HC CPLD",
-		.dev_id = 0x012BC043,
-		.dr_bits = 128,
-		.row_num = 3198,
-		.cpld_erase = lcmxo2_4000hc_cpld_erase,
-		.cpld_program = llcmxo2_4000hc_cpld_program,
-		.cpld_verify = lcmxo2_4000hc_cpld_verify,
-	},
+	int (*cpld_program)(struct jed_file *jed);
+	int (*cpld_verify)(struct jed_file *jed);
+	int (*cpld_read)(struct jed_writer *w);
+	int (*cpld_refresh)(void);
 };
@@ -0,0 +1,102 @@
+/*
+ * SVF (Serial Vector Format) player
+ *
+ * Statements are run through the ast_jtag scan queue, so runs of SIR/SDR/
+ * RUNTEST go to the controller together. SDR TDO checks are evaluated when
+ * the queue is flushed: before the next SIR, at ENDLOOP and at the end of
+ * the file, so a failed check never lets a later instruction through.
+ */
+
+#define SVF_CHECK_MAX		256	/* TDO checks pending before a flush */
+#define SVF_STMT_INIT		4096	/* initial statement buffer size */
+
+/**
+ * struct svf_vec - SIR/SDR/HIR/HDR/TIR/TDR parameters:
+ *
+ * @len: bits
+ * @tdi: TDI data, kept for following scans of the same length
+ * @tdo: expected TDO data, only for the scan that gives it
+ * @mask: TDO compare mask, kept for following scans of the same length
+ * @has_tdo: @tdo was given
+ */
+struct svf_vec {
+	unsigned int	len;
+	u32		*tdi;
+	u32		*tdo;
+	u32		*mask;
+	int		has_tdo;
+};
+
+/**
+ * struct svf_check - pending SDR TDO check:
+ *
+ * @buf: scan buffer, captured TDO after the flush, owned by the check
+ * @tdo: expected TDO, in the same allocation as @buf
+ * @mask: compare mask, in the same allocation as @buf
+ * @offset: first bit of the scan after the header bits
+ * @len: bits to compare
+ * @line: SVF line of the statement
+ */
+struct svf_check {
+	u32		*buf;
+	u32		*tdo;
+	u32		*mask;
+	unsigned int	offset;
+	unsigned int	len;
+	unsigned int	line;
+};
+
+/**
+ * struct svf_player - player state:
+ *
+ * @map: SVF file contents
+ * @size: bytes in @map
+ * @pos: offset of the next statement
+ * @line: line of the next statement
+ * @stmt: current statement, comments and line breaks removed, upper case
+ * @stmt_max: allocated size of @stmt
+ * @sir, @sdr, @hir, @hdr, @tir, @tdr: scan parameters
+ * @endir: SIR end state, 0 - IDLE, 1 - IRPAUSE
+ * @enddr: SDR end state, 0 - IDLE, 1 - DRPAUSE
+ * @runtest_end: RUNTEST end state, kept until a RUNTEST changes it
+ * @check: pending TDO checks, and SDR buffers waiting for the flush
+ * @nchecks: entries in @check
+ * @ntdo: entries in @check that compare TDO
+ * @loop_pos: offset of the first statement in the LOOP
+ * @loop_line: line of the first statement in the LOOP
+ * @loop_count: LOOP iterations
+ * @loop_iter: current LOOP iteration
+ * @in_loop: between LOOP and ENDLOOP
+ * @loop_fail: a TDO check failed in this LOOP iteration
+ * @statements: statements run
+ * @scans: SIR/SDR run
+ * @checks: TDO checks done
+ * @flushes: queue flushes done by the player
+ */
+struct svf_player {
+	const char	*map;
+	size_t		size;
+	size_t		pos;
+	unsigned int	line;
+	char		*stmt;
+	size_t		stmt_max;
+	struct svf_vec	sir, sdr, hir, hdr, tir, tdr;
+	unsigned char	endir;
+	unsigned char	enddr;
+	int		runtest_end;
+	struct svf_check check[SVF_CHECK_MAX];
+	int		nchecks;
+	int		ntdo;
+	size_t		loop_pos;
+	unsigned int	loop_line;
+	unsigned int	loop_count;
+	unsigned int	loop_iter;
+	int		in_loop;
+	int		loop_fail;
+	unsigned int	statements;
+	unsigned int	scans;
+	unsigned int	checks;
+	unsigned int	flushes;
+};
+
+int svf_play(const char *path);
@@ -11,12 +11,56 @@
 #include <sys/mman.h>
 #include "lattice.h"
 #include "ast-jtag.h"
-
-int jtag_fd;
+#include "jtag-backend.h"
+#include "jtag-trace.h"
+
+extern int debug;
+
+/*
+ * Controller state is per thread: main.c runs one thread per controller
+ * when several node:image jobs are given, each with its own ast_jtag_open().
+ */
+__thread int jtag_fd;
+
+/* controller picked by ast_jtag_open() */
+static __thread const struct jtag_backend *backend = &jtag_aspeed_backend;
+
+__thread struct jtag_stats jtag_stats;
+
+const char *jtag_call_names[JTAG_CALL_MAX] = {
+	[JTAG_CALL_XFER_BUF] = "xfer_buf",
+	[JTAG_CALL_XFER] = "xfer",
+	[JTAG_CALL_STATE] = "state",
+	[JTAG_CALL_BITBANG] = "bitbang",
+	[JTAG_CALL_FREQ] = "freq",
+	[JTAG_CALL_MODE] = "mode",
+	[JTAG_CALL_GPIO] = "gpio",
+};
+
+/* target device padding, all zero for a single device chain */
+static __thread struct jtag_chain jtag_chain;
+
+/* scan buffer for padded xfers, grown as needed */
+static __thread u32 *chain_buf;
+static __thread unsigned int chain_buf_words;
+
+/*
+ * JTAG_IOCXFER_BUF support of the driver: 1 - supported, 0 - legacy 32-bit
+ * JTAG_IOCXFER only, -1 - not probed yet. Where both structures have the same
+ * size the two ioctls share a number and cannot be told apart, so only the
+ * legacy one is used.
+ */
+static __thread int jtag_xfer_buf = (JTAG_IOCXFER_BUF != JTAG_IOCXFER) ? -1 : 0;
+
+/*
+ * JTAG_SIOCSTATE tck support of the driver, run-test clocks in one ioctl:
+ * 1 - supported, 0 - one JTAG_IOCBITBANG per TCK, -1 - not probed yet.
+ */
+static __thread int jtag_state_tck = -1;
 
 /*************************************************************************************/
-/*				AST JTAG LIB					*/
-int ast_jtag_open(char *dev)
+/*				ASPEED JTAG BACKEND				*/
+static int aspeed_open(const char *dev)
 {
 	jtag_fd = open(dev, O_RDWR);
 	if (jtag_fd == -1) {
@@ -26,15 +70,17 @@ int ast_jtag_open(char *dev)
 	return 0;
 }
 
-void ast_jtag_close(void)
+static void aspeed_close(void)
 {
 	close(jtag_fd);
 }
 
-unsigned int ast_get_jtag_freq(void)
+static unsigned int aspeed_get_freq(void)
 {
 	int retval;
 	unsigned int freq = 0;
+
+	JTAG_STATS_CALL(JTAG_CALL_FREQ);
 	retval = ioctl(jtag_fd, JTAG_GIOCFREQ, &freq);
 	if (retval == -1) {
 		perror("ioctl JTAG get freq fail!\n");
@@ -44,9 +90,11 @@ unsigned int ast_get_jtag_freq(void)
 	return freq;
 }
 
-int ast_set_jtag_freq(unsigned int freq)
+static int aspeed_set_freq(unsigned int freq)
 {
 	int retval;
+
+	JTAG_STATS_CALL(JTAG_CALL_FREQ);
 	retval = ioctl(jtag_fd, JTAG_SIOCFREQ, freq);
 	if (retval == -1) {
 		perror("ioctl JTAG set freq fail!\n");
@@ -56,14 +104,15 @@ int ast_set_jtag_freq(unsigned int freq)
 	return 0;
 }
 
-int ast_set_mode(unsigned int mode)
+static int aspeed_set_mode(unsigned int mode)
 {
 	int retval;
 	struct jtag_mode j_mode;
 
 	j_mode.feature = 0; /* JTAG feature setting selector for JTAG controller HW/SW */
 	j_mode.mode = mode;
-    
+
+	JTAG_STATS_CALL(JTAG_CALL_MODE);
 	retval = ioctl(jtag_fd, JTAG_SIOCMODE, &j_mode);
 	if (retval == -1) {
 		perror("ioctl JTAG set mode fail!\n");
@@ -73,117 +122,505 @@ int ast_set_mode(unsigned int mode)
 	return 0;
 }
 
-int ast_jtag_xfer(unsigned char type, unsigned char direct,
-                  unsigned char end, unsigned int len, u32 *tdio)
+static unsigned char ast_jtag_endstate(unsigned char type, unsigned char end)
+{
+	if (end) {
+		//pause
+		if (type == JTAG_SIR_XFER)
+			return JTAG_STATE_PAUSEIR;
+		else
+			return JTAG_STATE_PAUSEDR;
+	}
+
+	//idle
+	return JTAG_STATE_IDLE;
+}
+
+/*
+ * aspeed_xfer_buf: shift len bits from/to tdio in one JTAG_IOCXFER_BUF.
+ * The first call probes the driver; if it only knows the legacy ioctl,
+ * -1 is returned silently and jtag_xfer_buf is cleared so callers fall back.
+ */
+static int aspeed_xfer_buf(unsigned char type, unsigned char direct,
+			   unsigned char end, unsigned int len, u32 *tdio)
 {
-	//write
 	int retval;
-	struct jtag_xfer xfer;
+	struct jtag_xfer_buf xfer;
+
+	if (jtag_xfer_buf == 0)
+		return -1;
 
+	memset(&xfer, 0, sizeof(xfer));
 	xfer.type = type;
 	xfer.direction = direct;
+	xfer.from = JTAG_STATE_CURRENT;
+	xfer.endstate = ast_jtag_endstate(type, end);
 	xfer.length = len;
-	xfer.tdio = *tdio;
-//	printf("tdio1=%llx\n", *tdio);
-//	printf("tdio2=%llx\n", xfer.tdio);
-//	printf("sizeof struct jtag_xfer=%d\n", sizeof(struct jtag_xfer));
-	if (end) {
-		//pause
-		if (type == JTAG_SIR_XFER)
-			xfer.endstate = JTAG_STATE_PAUSEIR;
-		else 
-			xfer.endstate = JTAG_STATE_PAUSEDR;
-	} else {
-		//idle
-		xfer.endstate = JTAG_STATE_IDLE;
-	}
+	xfer.tdio = (u64) (unsigned long) tdio;
 
-	retval = ioctl(jtag_fd, JTAG_IOCXFER, &xfer);
+	JTAG_STATS_CALL(JTAG_CALL_XFER_BUF);
+	retval = ioctl(jtag_fd, JTAG_IOCXFER_BUF, &xfer);
 	if (retval == -1) {
-		perror("ioctl JTAG data xfer fail!\n");
+		if ((jtag_xfer_buf == -1) && ((errno == ENOTTY) || (errno == EINVAL))) {
+			if (debug) printf("JTAG driver has no buffer xfer, using 32-bit xfer\n");
+			jtag_xfer_buf = 0;
+			return -1;
+		}
+		perror("ioctl JTAG buffer xfer fail!\n");
 		return -1;
 	}
-	*tdio = (u32) xfer.tdio;
 
-//	if(enddr)
-//		usleep(3000);
+	if (jtag_xfer_buf == -1) {
+		if (debug) printf("JTAG driver supports buffer xfer\n");
+		jtag_xfer_buf = 1;
+	}
+
 	return 0;
 }
 
-int ast_jtag_sir_xfer(unsigned char endir, unsigned int len,
-                               u32 *tdi, u32 *tdo)
+/* aspeed_xfer32: one legacy JTAG_IOCXFER of up to 32 bits */
+static int aspeed_xfer32(unsigned char type, unsigned char direct,
+			 unsigned char end, unsigned int len, u32 *tdio)
 {
-	int 	retval;
-
-	if (len > 32)
-		return -1;
+	int retval;
+	struct jtag_xfer xfer;
 
+	xfer.type = type;
+	xfer.direction = direct;
+	xfer.length = len;
+	xfer.tdio = *tdio;
+	xfer.endstate = ast_jtag_endstate(type, end);
 
-	retval = ast_jtag_xfer(JTAG_SIR_XFER, JTAG_WRITE_XFER, endir, len, tdi);
+	JTAG_STATS_CALL(JTAG_CALL_XFER);
+	retval = ioctl(jtag_fd, JTAG_IOCXFER, &xfer);
 	if (retval == -1) {
-		perror("ioctl JTAG sir fail!\n");
+		perror("ioctl JTAG data xfer fail!\n");
 		return -1;
 	}
-//	if(endir)
-//		usleep(3000);
-	// return *sir.tdo;
+	*tdio = (u32) xfer.tdio;
+
 	return 0;
 }
 
-int ast_jtag_tdi_xfer(unsigned char enddr, unsigned int len, u32 *tdio)
+/*
+ * aspeed_xfer: shift a SIR/SDR of len bits, in one buffer xfer when the
+ * driver has it, else SDRs in 32-bit xfers. A legacy SIR is 32 bits at most.
+ */
+static int aspeed_xfer(unsigned char type, unsigned char direct,
+		       unsigned char end, unsigned int len, u32 *tdio)
 {
-	//write
-	int retval = 0;
 	int count, i;
 	unsigned int bit_len;
 
+	if (jtag_xfer_buf != 0) {
+		if (aspeed_xfer_buf(type, direct, end, len, tdio) == 0)
+			return 0;
+		if (jtag_xfer_buf != 0)
+			return -1;
+	}
+
+	if (len <= 32)
+		return aspeed_xfer32(type, direct, end, len, tdio);
+	if (type == JTAG_SIR_XFER)
+		return -1;
+
 	count = len / 32 + 1;
 	for (i = 0; i < count; i++) {
 		if (i == (count - 1))
 			bit_len = len % 32;
 		else
 			bit_len = 32;
-		if (bit_len != 0)
-			retval = ast_jtag_xfer(JTAG_SDR_XFER, JTAG_WRITE_XFER, enddr, bit_len, &tdio[i]);
+		if ((bit_len != 0) && (aspeed_xfer32(type, direct, end, bit_len, &tdio[i]) < 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * aspeed_runtest_state: clock tcks TCKs in IDLE with JTAG_SIOCSTATE, up to
+ * JTAG_STATE_TCK_MAX per ioctl. The first call probes the driver; without
+ * tck support -1 is returned silently and jtag_state_tck is cleared.
+ */
+static int aspeed_runtest_state(unsigned int tcks)
+{
+	int retval;
+	struct jtag_end_tap_state state;
+
+	while (tcks) {
+		state.reset = JTAG_NO_RESET;
+		state.endstate = JTAG_STATE_IDLE;
+		state.tck = (tcks > JTAG_STATE_TCK_MAX) ? JTAG_STATE_TCK_MAX : tcks;
+
+		JTAG_STATS_CALL(JTAG_CALL_STATE);
+		retval = ioctl(jtag_fd, JTAG_SIOCSTATE, &state);
 		if (retval == -1) {
-			perror("ioctl JTAG tdi fail!\n");
+			if ((jtag_state_tck == -1) && ((errno == ENOTTY) || (errno == EINVAL))) {
+				if (debug) printf("JTAG driver has no run-test clocks, using bitbang\n");
+				jtag_state_tck = 0;
+				return -1;
+			}
+			perror("ioctl JTAG run-test fail!\n");
 			return -1;
 		}
+		jtag_state_tck = 1;
+		tcks -= state.tck;
 	}
 
-//	if(endir)
-//		usleep(3000);
-	// return *sir.tdo;
 	return 0;
 }
 
-int ast_jtag_tdo_xfer(unsigned char enddr, unsigned int len, u32 *tdio)
+static int aspeed_runtest(unsigned int tcks)
 {
-	//read
+	int i = 0;
 	int retval;
-	int count, i;
-	unsigned int bit_len;
+	static __thread unsigned int idle_count = 0;
+	struct tck_bitbang tck_bitbang;
 
-	count = len / 32 + 1;
-	for (i = 0; i < count; i++) {
-		if (i == (count - 1))
-			bit_len = len % 32;
-		else
-			bit_len = 32;
-		if (bit_len != 0)
-			retval = ast_jtag_xfer(JTAG_SDR_XFER, JTAG_READ_XFER, enddr, bit_len, &tdio[i]);
+	// all clocks in one ioctl where the driver takes a tck count
+	if (jtag_state_tck != 0) {
+		if (aspeed_runtest_state(tcks) == 0)
+			return 0;
+		if (jtag_state_tck != 0)
+			return -1;
+	}
+
+	tck_bitbang.tdi = 0;
+	tck_bitbang.tms = 0;
+	tck_bitbang.tdo = 0;
+	for(i = 0; i< tcks; i++) {
+		JTAG_STATS_CALL(JTAG_CALL_BITBANG);
+		retval = ioctl(jtag_fd, JTAG_IOCBITBANG, &tck_bitbang);
 		if (retval == -1) {
-			perror("ioctl JTAG tdi fail!\n");
+			perror("ioctl JTAG bitbang fail!\n");
+			return -1;
+		}
+	}
+
+	//msleep :: for kernel switch other task.
+	if((idle_count ++ ) % 128 == 0){
+		usleep(0);
+ 	}
+
+	return 0;
+}
+
+static int aspeed_set_state(unsigned char reset, unsigned char endstate)
+{
+	int retval;
+	struct jtag_end_tap_state state;
+
+	state.reset = reset;
+	state.endstate = endstate;
+	state.tck = 0;
+
+	JTAG_STATS_CALL(JTAG_CALL_STATE);
+	retval = ioctl(jtag_fd, JTAG_SIOCSTATE, &state);
+	if (retval == -1) {
+		perror("ioctl JTAG set state fail!\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+const struct jtag_backend jtag_aspeed_backend = {
+	.name = "aspeed",
+	.open = aspeed_open,
+	.close = aspeed_close,
+	.get_freq = aspeed_get_freq,
+	.set_freq = aspeed_set_freq,
+	.set_mode = aspeed_set_mode,
+	.xfer = aspeed_xfer,
+	.runtest = aspeed_runtest,
+	.set_state = aspeed_set_state,
+};
+
+/*************************************************************************************/
+/*				AST JTAG LIB					*/
+/*
+ * ast_jtag_open: "gpio:<spec>" bit-bangs GPIO lines, "sim[<n>][:<file>]"
+ * runs the MachXO2 simulator, anything else is an Aspeed JTAG device node.
+ */
+int ast_jtag_open(char *dev)
+{
+	const char *arg = dev;
+
+	if (!strncmp(dev, "gpio:", 5)) {
+		backend = &jtag_gpio_backend;
+		arg = dev + 5;
+	} else if (!strncmp(dev, "sim", 3) &&
+		   (!dev[3] || (dev[3] == ':') || ((dev[3] >= '0') && (dev[3] <= '9')))) {
+		backend = &jtag_sim_backend;
+		arg = dev + 3;
+	} else {
+		backend = &jtag_aspeed_backend;
+	}
+
+	memset(&jtag_stats, 0, sizeof(jtag_stats));
+	memset(&jtag_chain, 0, sizeof(jtag_chain));
+
+	return backend->open(arg);
+}
+
+void ast_jtag_close(void)
+{
+	jtag_trace_close();
+
+	if (debug)
+		printf("JTAG %s: %llu xfers (%llu bits), %llu runtests (%llu tck), %llu driver calls\n",
+		       backend->name, jtag_stats.xfers, jtag_stats.xfer_bits,
+		       jtag_stats.runtests, jtag_stats.runtest_tcks, jtag_stats.calls);
+
+	backend->close();
+
+	free(chain_buf);
+	chain_buf = NULL;
+	chain_buf_words = 0;
+}
+
+unsigned int ast_get_jtag_freq(void)
+{
+	return backend->get_freq();
+}
+
+int ast_set_jtag_freq(unsigned int freq)
+{
+	int retval;
+
+	if (!jtag_trace)
+		return backend->set_freq(freq);
+
+	jtag_trace_begin(JTAG_TRACE_FREQ, 0, 0, freq, NULL);
+	retval = backend->set_freq(freq);
+	jtag_trace_end(retval, NULL);
+
+	return retval;
+}
+
+int ast_set_mode(unsigned int mode)
+{
+	return backend->set_mode(mode);
+}
+
+/* jtag_bits_copy: copy len bits, LSB first, from src at src_pos to dst at dst_pos */
+void jtag_bits_copy(u32 *dst, unsigned int dst_pos, const u32 *src,
+		    unsigned int src_pos, unsigned int len)
+{
+	if (!(dst_pos % 32) && !(src_pos % 32)) {
+		memcpy(&dst[dst_pos / 32], &src[src_pos / 32], (len / 32) * sizeof(u32));
+		dst_pos += len & ~31;
+		src_pos += len & ~31;
+		len %= 32;
+	}
+
+	for (; len; len--, dst_pos++, src_pos++) {
+		if ((src[src_pos / 32] >> (src_pos % 32)) & 1)
+			dst[dst_pos / 32] |= 1u << (dst_pos % 32);
+		else
+			dst[dst_pos / 32] &= ~(1u << (dst_pos % 32));
+	}
+}
+
+/*
+ * ast_jtag_chain_xfer: one xfer with the header bits for the devices next
+ * to TDO first and the trailer bits for the devices next to TDI last, so
+ * the padding costs no extra controller call.
+ */
+static int ast_jtag_chain_xfer(unsigned char type, unsigned char direct,
+			       unsigned char end, unsigned int len, u32 *tdio,
+			       unsigned int head, unsigned int tail)
+{
+	unsigned int total = head + len + tail;
+	unsigned int words = (total + 31) / 32;
+	u32 *buf;
+	int retval;
+
+	if (words > chain_buf_words) {
+		buf = realloc(chain_buf, words * sizeof(u32));
+		if (!buf) {
+			printf("Out of memory for a %u bit scan\n", total);
 			return -1;
 		}
+		chain_buf = buf;
+		chain_buf_words = words;
+	}
+
+	//other devices get BYPASS in IR, anything in DR; the padding is
+	//shifted in even around a read-only scan
+	memset(chain_buf, (type == JTAG_SIR_XFER) ? 0xff : 0, words * sizeof(u32));
+	if (direct & JTAG_WRITE_XFER)
+		jtag_bits_copy(chain_buf, head, tdio, 0, len);
+
+	retval = backend->xfer(type, direct | JTAG_WRITE_XFER, end, total, chain_buf);
+	if ((retval == 0) && (direct & JTAG_READ_XFER))
+		jtag_bits_copy(tdio, 0, chain_buf, head, len);
+
+	return retval;
+}
+
+static int ast_jtag_pad_xfer(unsigned char type, unsigned char direct,
+			     unsigned char end, unsigned int len, u32 *tdio)
+{
+	unsigned int head, tail;
+
+	if (type == JTAG_SIR_XFER) {
+		head = jtag_chain.hir;
+		tail = jtag_chain.tir;
+	} else {
+		head = jtag_chain.hdr;
+		tail = jtag_chain.tdr;
+	}
+	if (head || tail)
+		return ast_jtag_chain_xfer(type, direct, end, len, tdio, head, tail);
+
+	return backend->xfer(type, direct, end, len, tdio);
+}
+
+int ast_jtag_xfer(unsigned char type, unsigned char direct,
+                  unsigned char end, unsigned int len, u32 *tdio)
+{
+	int retval;
+
+	jtag_stats.xfers++;
+	jtag_stats.xfer_bits += len;
+	if (type == JTAG_SIR_XFER) {
+		jtag_stats.sir_xfers++;
+		jtag_stats.sir_bits += len;
+	}
+
+	if (!jtag_trace)
+		return ast_jtag_pad_xfer(type, direct, end, len, tdio);
+
+	//recorded before the chain padding, so a trace replays on any chain
+	jtag_trace_begin(type, direct, end, len, tdio);
+	retval = ast_jtag_pad_xfer(type, direct, end, len, tdio);
+	jtag_trace_end(retval, tdio);
+
+	return retval;
+}
+
+/*
+ * ast_jtag_set_chain: pad every following SIR/SDR for the target device,
+ * NULL goes back to a single device chain.
+ */
+void ast_jtag_set_chain(const struct jtag_chain *chain)
+{
+	if (chain)
+		jtag_chain = *chain;
+	else
+		memset(&jtag_chain, 0, sizeof(jtag_chain));
+}
+
+/*
+ * ast_jtag_chain_scan: count the devices on the chain and read all their
+ * IDCODEs in one DR scan. Test-Logic-Reset selects IDCODE, 32 bits with
+ * bit 0 set, or BYPASS, a single 0 bit, in every device; the ones shifted
+ * in come out after the last device. idcode[0] is the device next to TDO,
+ * 0 for a device without IDCODE. Returns the device count, -1 on error.
+ */
+int ast_jtag_chain_scan(u32 *idcode, int max)
+{
+	unsigned int len = (max + 1) * 32;
+	unsigned int pos = 0;
+	u32 tdio[JTAG_CHAIN_MAX + 1], id;
+	int n = 0;
+
+	if (max > JTAG_CHAIN_MAX)
+		return -1;
+
+	ast_jtag_set_chain(NULL);
+	if (ast_jtag_set_tap_state(1, JTAG_STATE_IDLE) < 0)
+		return -1;
+
+	memset(tdio, 0xff, sizeof(tdio));
+	if (ast_jtag_sdr_xfer(JTAG_READ_XFER | JTAG_WRITE_XFER, 0, len, tdio) < 0)
+		return -1;
+
+	while (pos + 32 <= len) {
+		id = 0;
+		jtag_bits_copy(&id, 0, tdio, pos, 32);
+		if (id == 0xffffffff)
+			return n;
+		if (n == max)
+			break;
+		if (id & 1) {
+			idcode[n++] = id;
+			pos += 32;
+		} else {
+			idcode[n++] = 0;
+			pos += 1;
+		}
 	}
 
+	printf("JTAG chain: no end after %d devices, TDO stuck or chain too long\n", max);
+
+	return -1;
+}
+
+int ast_jtag_sir_xfer(unsigned char endir, unsigned int len,
+                               u32 *tdi, u32 *tdo)
+{
+	int 	retval;
+
+	if (len > 32)
+		return -1;
+
+
+	retval = ast_jtag_xfer(JTAG_SIR_XFER, JTAG_WRITE_XFER, endir, len, tdi);
+	if (retval == -1) {
+		perror("ioctl JTAG sir fail!\n");
+		return -1;
+	}
 //	if(endir)
 //		usleep(3000);
 	// return *sir.tdo;
 	return 0;
 }
 
+/*
+ * ast_jtag_sdr_xfer: shift an SDR of len bits from/to tdio.
+ */
+int ast_jtag_sdr_xfer(unsigned char direct, unsigned char enddr, unsigned int len, u32 *tdio)
+{
+	if (ast_jtag_xfer(JTAG_SDR_XFER, direct, enddr, len, tdio) < 0) {
+		perror("ioctl JTAG sdr fail!\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int ast_jtag_tdi_xfer(unsigned char enddr, unsigned int len, u32 *tdio)
+{
+	//write
+	return ast_jtag_sdr_xfer(JTAG_WRITE_XFER, enddr, len, tdio);
+}
+
+int ast_jtag_tdo_xfer(unsigned char enddr, unsigned int len, u32 *tdio)
+{
+	//read
+	return ast_jtag_sdr_xfer(JTAG_READ_XFER, enddr, len, tdio);
+}
+
+/*
+ * ast_jtag_set_tap_state: move the TAP to endstate, through Test-Logic-Reset
+ * first with reset set.
+ */
+int ast_jtag_set_tap_state(unsigned char reset, unsigned char endstate)
+{
+	int retval;
+
+	if (!jtag_trace)
+		return backend->set_state(reset, endstate);
+
+	jtag_trace_begin(JTAG_TRACE_STATE, reset, endstate, 0, NULL);
+	retval = backend->set_state(reset, endstate);
+	jtag_trace_end(retval, NULL);
+
+	return retval;
+}
+
 int ast_jtag_run_test_idle(unsigned char reset, unsigned char end, unsigned char tck)
 
 {
@@ -208,29 +645,168 @@ int ast_jtag_run_test_idle(unsigned char reset, unsigned char end, unsigned char
 	return 0;
 }
 
+/* ast_jtag_wait: stay usec in Run-Test/Idle */
+static void ast_jtag_wait(unsigned int usec)
+{
+	if (jtag_trace)
+		jtag_trace_begin(JTAG_TRACE_WAIT, 0, 0, usec, NULL);
+	usleep(usec);
+	if (jtag_trace)
+		jtag_trace_end(0, NULL);
+}
+
 void jtag_runtest_idle(unsigned int tcks, unsigned int min_mSec)
 {
-	int i = 0;
 	int retval;
-	static unsigned int idle_count = 0;
-	struct tck_bitbang tck_bitbang;
 
-	tck_bitbang.tdi = 0;
-	tck_bitbang.tms = 0;
-	tck_bitbang.tdo = 0;
-	for(i = 0; i< tcks; i++) {
-		retval = ioctl(jtag_fd, JTAG_IOCBITBANG, &tck_bitbang);
-		if (retval == -1) {
-			perror("ioctl JTAG bitbang fail!\n");
-			break;
-		}
+	jtag_stats.runtests++;
+	jtag_stats.runtest_tcks += tcks;
+
+	if (tcks) {
+		if (jtag_trace)
+			jtag_trace_begin(JTAG_TRACE_RUNTEST, 0, 0, tcks, NULL);
+		retval = backend->runtest(tcks);
+		if (jtag_trace)
+			jtag_trace_end(retval, NULL);
 	}
 
 	if (min_mSec != 0){
-		usleep(min_mSec * 1000);
+		ast_jtag_wait(min_mSec * 1000);
 	}
-	//msleep :: for kernel switch other task.
-	if((idle_count ++ ) % 128 == 0){
-		usleep(0);
- 	}
+}
+
+/*************************************************************************************/
+/*				AST JTAG SCAN QUEUE				*/
+/*
+ * SIR/SDR/RUNTEST operations are queued and run in order on
+ * ast_jtag_queue_flush(), or when the queue is full. The JTAG uAPI has no
+ * multi-scan ioctl, so a flush still costs one driver call per SIR/SDR;
+ * only adjacent RUNTEST operations are merged into one run-test and one
+ * idle wait. SDR data arrays must stay valid until the queue is flushed.
+ */
+static __thread struct jtag_scan_op scan_queue[JTAG_SCAN_QUEUE_DEPTH];
+static __thread int scan_queue_len = 0;
+
+static struct jtag_scan_op *ast_jtag_queue_op(void)
+{
+	if (scan_queue_len == JTAG_SCAN_QUEUE_DEPTH) {
+		if (ast_jtag_queue_flush() < 0)
+			return NULL;
+	}
+
+	return &scan_queue[scan_queue_len++];
+}
+
+int ast_jtag_queue_sir(unsigned char endir, unsigned int len, u32 tdi)
+{
+	struct jtag_scan_op *op;
+
+	if (len > 32)
+		return -1;
+
+	op = ast_jtag_queue_op();
+	if (!op)
+		return -1;
+
+	op->type = JTAG_SCAN_SIR;
+	op->direction = JTAG_WRITE_XFER;
+	op->end = endir;
+	op->len = len;
+	op->usec = 0;
+	op->ir = tdi;
+	op->tdio = NULL;
+
+	return 0;
+}
+
+int ast_jtag_queue_sdr(unsigned char direct, unsigned char enddr,
+		       unsigned int len, u32 *tdio)
+{
+	struct jtag_scan_op *op;
+
+	op = ast_jtag_queue_op();
+	if (!op)
+		return -1;
+
+	op->type = JTAG_SCAN_SDR;
+	op->direction = direct;
+	op->end = enddr;
+	op->len = len;
+	op->usec = 0;
+	op->ir = 0;
+	op->tdio = tdio;
+
+	return 0;
+}
+
+int ast_jtag_queue_tdi(unsigned char enddr, unsigned int len, u32 *tdio)
+{
+	return ast_jtag_queue_sdr(JTAG_WRITE_XFER, enddr, len, tdio);
+}
+
+int ast_jtag_queue_tdo(unsigned char enddr, unsigned int len, u32 *tdio)
+{
+	return ast_jtag_queue_sdr(JTAG_READ_XFER, enddr, len, tdio);
+}
+
+int ast_jtag_queue_runtest(unsigned int tcks, unsigned int usec)
+{
+	struct jtag_scan_op *op;
+
+	if ((tcks == 0) && (usec == 0))
+		return 0;
+
+	//RUNTEST followed by RUNTEST is one longer RUNTEST
+	if (scan_queue_len > 0) {
+		op = &scan_queue[scan_queue_len - 1];
+		if (op->type == JTAG_SCAN_RUNTEST) {
+			op->len += tcks;
+			op->usec += usec;
+			return 0;
+		}
+	}
+
+	op = ast_jtag_queue_op();
+	if (!op)
+		return -1;
+
+	op->type = JTAG_SCAN_RUNTEST;
+	op->direction = 0;
+	op->end = 0;
+	op->len = tcks;
+	op->usec = usec;
+	op->ir = 0;
+	op->tdio = NULL;
+
+	return 0;
+}
+
+int ast_jtag_queue_flush(void)
+{
+	struct jtag_scan_op *op;
+	int i, retval = 0;
+
+	for (i = 0; i < scan_queue_len; i++) {
+		op = &scan_queue[i];
+		switch (op->type) {
+		case JTAG_SCAN_SIR:
+			retval = ast_jtag_sir_xfer(op->end, op->len, &op->ir, NULL);
+			break;
+		case JTAG_SCAN_SDR:
+			retval = ast_jtag_sdr_xfer(op->direction, op->end, op->len, op->tdio);
+			break;
+		case JTAG_SCAN_RUNTEST:
+			if (op->len)
+				jtag_runtest_idle(op->len, 0);
+			if (op->usec)
+				ast_jtag_wait(op->usec);
+			break;
+		}
+		if (retval == -1)
+			break;
+	}
+
+	scan_queue_len = 0;
+
+	return retval;
 }
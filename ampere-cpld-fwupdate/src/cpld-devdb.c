@@ -0,0 +1,202 @@
+/*
+Device database: built-in MachXO2/MachXO3LF table and --devdb files
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "lattice.h"
+#include "ast-jtag.h"
+#include "cpld-devdb.h"
+
+extern int debug;
+
+/*
+ * Timing of the MachXO2 flow. The worst cases are the loop bounds of the
+ * Diamond SVF files: erase LOOP n of 10 ms, row program 1 ms then LOOP 10
+ * of 3 ms, DONE LOOP 10 of 3 ms, REFRESH 100 ms. A --devdb line replaces
+ * them with the figures measured on a board.
+ */
+#define XO2_PROG_US		200
+#define XO2_PROG_MAX_US		31000
+#define XO2_DONE_MAX_US		30000
+#define XO2_REFRESH_US		100000
+
+#define LATTICE_DEV(_family, _part, _id, _rows, _ufm, _erase, _erase_max)	\
+	{								\
+		.name = "LATTICE " _family " " _part " CPLD",		\
+		.part = _part,						\
+		.dev_id = _id,						\
+		.dr_bits = 128,						\
+		.ir_bits = LATTICE_INS_LENGTH,				\
+		.row_num = _rows,					\
+		.ufm_rows = _ufm,					\
+		.timing = {						\
+			.erase = _erase,				\
+			.erase_max = _erase_max,			\
+			.prog = XO2_PROG_US,				\
+			.prog_max = XO2_PROG_MAX_US,			\
+			.done = XO2_DONE_MAX_US,			\
+			.refresh = XO2_REFRESH_US,			\
+		},							\
+		.cpld_erase = lcmxo2_4000hc_cpld_erase,			\
+		.cpld_program = llcmxo2_4000hc_cpld_program,		\
+		.cpld_verify = lcmxo2_4000hc_cpld_verify,		\
+		.cpld_read = lcmxo2_4000hc_cpld_read,			\
+		.cpld_refresh = lcmxo2_4000hc_cpld_refresh,		\
+	}
+
+/*
+ * HC/HE and ZE parts of a size share the array, HE the IDCODE of HC. The
+ * table ends at the first entry without an IDCODE.
+ */
+struct cpld_dev_info lattice_device_list[CPLD_DEV_MAX] = {
+	LATTICE_DEV("MachXO2", "LCMXO2-4000HC", 0x012BC043, 5758, 767, 1000000, 3500000),
+	LATTICE_DEV("MachXO2", "LCMXO2-256HC", 0x012B8043, 575, 0, 300000, 1500000),
+	LATTICE_DEV("MachXO2", "LCMXO2-640HC", 0x012B9043, 1152, 191, 400000, 2000000),
+	LATTICE_DEV("MachXO2", "LCMXO2-1200HC", 0x012BA043, 2175, 512, 600000, 2500000),
+	LATTICE_DEV("MachXO2", "LCMXO2-2000HC", 0x012BB043, 3198, 639, 800000, 3000000),
+	LATTICE_DEV("MachXO2", "LCMXO2-7000HC", 0x012BD043, 9212, 2048, 1500000, 5000000),
+	LATTICE_DEV("MachXO2", "LCMXO2-256ZE", 0x012B0043, 575, 0, 300000, 1500000),
+	LATTICE_DEV("MachXO2", "LCMXO2-640ZE", 0x012B1043, 1152, 191, 400000, 2000000),
+	LATTICE_DEV("MachXO2", "LCMXO2-1200ZE", 0x012B2043, 2175, 512, 600000, 2500000),
+	LATTICE_DEV("MachXO2", "LCMXO2-2000ZE", 0x012B3043, 3198, 639, 800000, 3000000),
+	LATTICE_DEV("MachXO2", "LCMXO2-4000ZE", 0x012B4043, 5758, 767, 1000000, 3500000),
+	LATTICE_DEV("MachXO2", "LCMXO2-7000ZE", 0x012B5043, 9212, 2048, 1500000, 5000000),
+	//MachXO3LF, the arrays of the MachXO2 1200 to 7000
+	LATTICE_DEV("MachXO3", "LCMXO3LF-1300E", 0x612B2043, 2175, 512, 600000, 2500000),
+	LATTICE_DEV("MachXO3", "LCMXO3LF-2100E", 0x612B3043, 3198, 639, 800000, 3000000),
+	LATTICE_DEV("MachXO3", "LCMXO3LF-4300E", 0x612B4043, 5758, 767, 1000000, 3500000),
+	LATTICE_DEV("MachXO3", "LCMXO3LF-6900E", 0x612B5043, 9212, 2048, 1500000, 5000000),
+	LATTICE_DEV("MachXO3", "LCMXO3LF-1300C", 0x612BA043, 2175, 512, 600000, 2500000),
+	LATTICE_DEV("MachXO3", "LCMXO3LF-2100C", 0x612BB043, 3198, 639, 800000, 3000000),
+	LATTICE_DEV("MachXO3", "LCMXO3LF-4300C", 0x612BC043, 5758, 767, 1000000, 3500000),
+	LATTICE_DEV("MachXO3", "LCMXO3LF-6900C", 0x612BD043, 9212, 2048, 1500000, 5000000),
+};
+
+/*************************************************************************************/
+
+/* cpld_dev_lookup: lattice_device_list entry for idcode, NULL if unknown */
+struct cpld_dev_info *cpld_dev_lookup(unsigned int idcode)
+{
+	int i;
+
+	for (i = 0; (i < CPLD_DEV_MAX) && lattice_device_list[i].dev_id; i++) {
+		if (idcode == lattice_device_list[i].dev_id)
+			return &lattice_device_list[i];
+	}
+
+	return NULL;
+}
+
+/* cpld_dev_lookup_part: entry for a JEDEC "DEVICE NAME", the part is a prefix */
+struct cpld_dev_info *cpld_dev_lookup_part(const char *device)
+{
+	int i;
+
+	for (i = 0; (i < CPLD_DEV_MAX) && lattice_device_list[i].dev_id; i++) {
+		if (!strncmp(device, lattice_device_list[i].part,
+			     strlen(lattice_device_list[i].part)))
+			return &lattice_device_list[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * cpld_devdb_line: one device line into dev, the optional DONE and
+ * REFRESH times kept as they are. Returns -1 on a bad line.
+ */
+static int cpld_devdb_line(const char *line, char *part, struct cpld_dev_info *dev)
+{
+	struct cpld_timing *t = &dev->timing;
+	unsigned int dr_bits;
+	int n;
+
+	n = sscanf(line, "%31s %x %u %u %u %u %u %u %u %u %u", part, &dev->dev_id,
+		   &dev->row_num, &dev->ufm_rows, &dr_bits, &t->erase, &t->erase_max,
+		   &t->prog, &t->prog_max, &t->done, &t->refresh);
+	if (n < 9)
+		return -1;
+	if (!dev->row_num || !dr_bits || (dr_bits % 32) ||
+	    (t->erase > t->erase_max) || (t->prog > t->prog_max))
+		return -1;
+	dev->dr_bits = dr_bits;
+
+	return 0;
+}
+
+/*
+ * cpld_devdb_load: read --devdb path. Returns -1 on an unreadable file or
+ * a bad line, the table is left as it was before that line.
+ */
+int cpld_devdb_load(const char *path)
+{
+	struct cpld_dev_info dev, *old;
+	char line[256], part[32], *p;
+	int lineno = 0, added = 0, updated = 0, retval = 0;
+	int count = 0;
+	FILE *fp;
+
+	while ((count < CPLD_DEV_MAX) && lattice_device_list[count].dev_id)
+		count++;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		p = line + strspn(line, " \t");
+		if ((*p == '#') || (*p == '\n') || (*p == '\0'))
+			continue;
+
+		//a new part starts from the family defaults
+		dev = lattice_device_list[0];
+		if (cpld_devdb_line(p, part, &dev) < 0) {
+			printf("%s:%d: bad device line\n", path, lineno);
+			retval = -1;
+			break;
+		}
+		//a known part keeps its own DONE and REFRESH times unless given
+		old = cpld_dev_lookup(dev.dev_id);
+		if (old) {
+			dev = *old;
+			cpld_devdb_line(p, part, &dev);
+		}
+
+		if (!old && (count == CPLD_DEV_MAX)) {
+			printf("%s:%d: more than %d devices\n", path, lineno, CPLD_DEV_MAX);
+			retval = -1;
+			break;
+		}
+		if (!old || strcmp(old->part, part)) {
+			dev.part = strdup(part);
+			dev.name = dev.part;
+			if (!dev.part) {
+				retval = -1;
+				break;
+			}
+		}
+
+		if (old) {
+			*old = dev;
+			updated++;
+		} else {
+			lattice_device_list[count++] = dev;
+			added++;
+		}
+		if (debug) printf("devdb: %s 0x%08X, %u rows, erase %u/%u us, row %u/%u us\n",
+				  dev.part, dev.dev_id, dev.row_num, dev.timing.erase,
+				  dev.timing.erase_max, dev.timing.prog, dev.timing.prog_max);
+	}
+
+	fclose(fp);
+	if (retval == 0)
+		printf("Device database %s: %d added, %d updated\n", path, added, updated);
+
+	return retval;
+}
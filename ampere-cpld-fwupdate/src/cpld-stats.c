@@ -0,0 +1,207 @@
+/*
+Update instrumentation: phase times, busy polls, slowest rows
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "ast-jtag.h"
+#include "jtag-backend.h"
+#include "cpld-stats.h"
+
+__thread struct cpld_stats cpld_stats;
+
+static const char *cpld_phase_names[CPLD_PHASE_MAX] = {
+	[CPLD_PHASE_NONE] = "other",
+	[CPLD_PHASE_OPEN] = "open",
+	[CPLD_PHASE_FREQ] = "auto_freq",
+	[CPLD_PHASE_PARSE] = "parse",
+	[CPLD_PHASE_CHECK] = "check",
+	[CPLD_PHASE_ERASE] = "erase",
+	[CPLD_PHASE_PROGRAM] = "program",
+	[CPLD_PHASE_FINISH] = "finish",
+	[CPLD_PHASE_VERIFY] = "verify",
+	[CPLD_PHASE_READ] = "read",
+	[CPLD_PHASE_REFRESH] = "refresh",
+};
+
+/*************************************************************************************/
+
+unsigned long long cpld_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void cpld_stats_reset(void)
+{
+	memset(&cpld_stats, 0, sizeof(cpld_stats));
+	cpld_stats.phase_start = cpld_time_us();
+}
+
+/* cpld_stats_phase: charge the time since the last switch, go on with phase */
+void cpld_stats_phase(int phase)
+{
+	unsigned long long now = cpld_time_us();
+
+	cpld_stats.phase_us[cpld_stats.phase] += now - cpld_stats.phase_start;
+	cpld_stats.phase_start = now;
+	cpld_stats.phase = phase;
+}
+
+void cpld_stats_busy(unsigned int polls)
+{
+	unsigned int bucket = 0;
+
+	while ((bucket < CPLD_BUSY_HIST - 1) && (polls > (1u << bucket)))
+		bucket++;
+
+	cpld_stats.busy_waits++;
+	cpld_stats.busy_polls += polls;
+	cpld_stats.busy_hist[bucket]++;
+}
+
+/* cpld_stats_row: count a programmed row, keep it if among the slowest */
+void cpld_stats_row(unsigned int row, unsigned int us, unsigned int polls)
+{
+	struct cpld_slow_row *slow = cpld_stats.slow;
+	unsigned int i;
+
+	cpld_stats.rows++;
+
+	if ((cpld_stats.nslow == CPLD_SLOW_ROWS) && (us <= slow[CPLD_SLOW_ROWS - 1].us))
+		return;
+
+	i = (cpld_stats.nslow < CPLD_SLOW_ROWS) ? cpld_stats.nslow++ : CPLD_SLOW_ROWS - 1;
+	for (; (i > 0) && (slow[i - 1].us < us); i--)
+		slow[i] = slow[i - 1];
+	slow[i].row = row;
+	slow[i].us = us;
+	slow[i].polls = polls;
+}
+
+void cpld_stats_erase(unsigned int us, unsigned int predict_us, unsigned int polls, int bound)
+{
+	cpld_stats.erase_us = us;
+	cpld_stats.erase_predict_us = predict_us;
+	cpld_stats.erase_polls = polls;
+	cpld_stats.erase_bound = bound;
+}
+
+/* bucket n of the busy histogram holds waits of lo..hi polls */
+static void cpld_stats_bucket(unsigned int n, unsigned int *lo, unsigned int *hi)
+{
+	*lo = n ? (1u << (n - 1)) + 1 : 1;
+	*hi = (n < CPLD_BUSY_HIST - 1) ? 1u << n : 0;
+}
+
+/*************************************************************************************/
+
+void cpld_stats_text(FILE *fp, const struct cpld_stats *s, const struct jtag_stats *js)
+{
+	unsigned int i, lo, hi;
+
+	fprintf(fp, "  phases:");
+	for (i = 0; i < CPLD_PHASE_MAX; i++) {
+		if (s->phase_us[i])
+			fprintf(fp, " %s %llu.%03llu s", cpld_phase_names[i],
+				s->phase_us[i] / 1000000, s->phase_us[i] / 1000 % 1000);
+	}
+	fprintf(fp, "\n");
+
+	fprintf(fp, "  jtag: %llu xfers (%llu bits, SIR %llu/%llu bits), %llu runtests (%llu tck)\n",
+		js->xfers, js->xfer_bits, js->sir_xfers, js->sir_bits,
+		js->runtests, js->runtest_tcks);
+	fprintf(fp, "  driver calls: %llu,", js->calls);
+	for (i = 0; i < JTAG_CALL_MAX; i++) {
+		if (js->call[i])
+			fprintf(fp, " %s %llu", jtag_call_names[i], js->call[i]);
+	}
+	fprintf(fp, "\n");
+
+	if (s->erase_us)
+		fprintf(fp, "  erase: %s%u.%03u s, expected %u.%03u s, %u polls\n",
+			s->erase_bound ? "at most " : "", s->erase_us / 1000000, s->erase_us / 1000 % 1000,
+			s->erase_predict_us / 1000000, s->erase_predict_us / 1000 % 1000,
+			s->erase_polls);
+
+	if (s->busy_waits) {
+		fprintf(fp, "  busy waits: %u, %llu polls, by polls:", s->busy_waits, s->busy_polls);
+		for (i = 0; i < CPLD_BUSY_HIST; i++) {
+			if (!s->busy_hist[i])
+				continue;
+			cpld_stats_bucket(i, &lo, &hi);
+			if (!hi)
+				fprintf(fp, " %u+: %u", lo, s->busy_hist[i]);
+			else if (lo == hi)
+				fprintf(fp, " %u: %u", lo, s->busy_hist[i]);
+			else
+				fprintf(fp, " %u-%u: %u", lo, hi, s->busy_hist[i]);
+		}
+		fprintf(fp, "\n");
+	}
+
+	if (s->nslow) {
+		fprintf(fp, "  slowest of %u rows:", s->rows);
+		for (i = 0; i < s->nslow; i++)
+			fprintf(fp, " %u (%u us, %u polls)", s->slow[i].row, s->slow[i].us, s->slow[i].polls);
+		fprintf(fp, "\n");
+	}
+}
+
+/* cpld_json_string: s as a quoted JSON string */
+void cpld_json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		if ((*s == '"') || (*s == '\\'))
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+/* cpld_stats_json: one JSON object, no trailing newline */
+void cpld_stats_json(FILE *fp, const struct cpld_stats *s, const struct jtag_stats *js)
+{
+	unsigned int i, lo, hi;
+
+	fprintf(fp, "{\"phases_us\": {");
+	for (i = 0; i < CPLD_PHASE_MAX; i++)
+		fprintf(fp, "%s\"%s\": %llu", i ? ", " : "", cpld_phase_names[i], s->phase_us[i]);
+	fprintf(fp, "}, ");
+
+	fprintf(fp, "\"jtag\": {\"xfers\": %llu, \"xfer_bits\": %llu, \"sir_xfers\": %llu, "
+		"\"sir_bits\": %llu, \"sdr_xfers\": %llu, \"sdr_bits\": %llu, "
+		"\"runtests\": %llu, \"runtest_tcks\": %llu, \"driver_calls\": %llu, \"calls\": {",
+		js->xfers, js->xfer_bits, js->sir_xfers, js->sir_bits,
+		js->xfers - js->sir_xfers, js->xfer_bits - js->sir_bits,
+		js->runtests, js->runtest_tcks, js->calls);
+	for (i = 0; i < JTAG_CALL_MAX; i++)
+		fprintf(fp, "%s\"%s\": %llu", i ? ", " : "", jtag_call_names[i], js->call[i]);
+	fprintf(fp, "}}, ");
+
+	fprintf(fp, "\"busy\": {\"waits\": %u, \"polls\": %llu, \"histogram\": [",
+		s->busy_waits, s->busy_polls);
+	for (i = 0; i < CPLD_BUSY_HIST; i++) {
+		cpld_stats_bucket(i, &lo, &hi);
+		fprintf(fp, "%s{\"min_polls\": %u, \"max_polls\": %s%.0u, \"count\": %u}",
+			i ? ", " : "", lo, hi ? "" : "null", hi, s->busy_hist[i]);
+	}
+	fprintf(fp, "]}, ");
+
+	fprintf(fp, "\"erase\": {\"us\": %u, \"upper_bound\": %s, \"expected_us\": %u, "
+		"\"polls\": %u}, ", s->erase_us, s->erase_bound ? "true" : "false",
+		s->erase_predict_us, s->erase_polls);
+
+	fprintf(fp, "\"rows\": %u, \"slowest_rows\": [", s->rows);
+	for (i = 0; i < s->nslow; i++)
+		fprintf(fp, "%s{\"row\": %u, \"us\": %u, \"polls\": %u}", i ? ", " : "",
+			s->slow[i].row, s->slow[i].us, s->slow[i].polls);
+	fprintf(fp, "]}");
+}
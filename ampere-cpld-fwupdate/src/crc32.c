@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "ast-jtag.h"
+#include "crc32.h"
+
+/* crc32_table[k][n]: CRC of byte n followed by k zero bytes */
+static u32 crc32_table[8][256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void)
+{
+	u32 crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+		crc32_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = crc32_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32_table[j][i] = crc;
+		}
+	}
+}
+
+/*
+ * crc32_update: slice-by-8, eight table lookups per 8 input bytes. The byte
+ * loop takes the unaligned head and the tail.
+ */
+u32 crc32_update(u32 crc, const void *buf, size_t len)
+{
+	const u8 *p = buf;
+	u32 lo, hi;
+
+	pthread_once(&crc32_table_once, crc32_init);
+
+	crc = ~crc;
+	while (len && ((unsigned long) p & 7)) {
+		crc = crc32_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+
+	while (len >= 8) {
+		memcpy(&lo, p, sizeof(lo));
+		memcpy(&hi, p + 4, sizeof(hi));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= crc;
+		crc = crc32_table[7][lo & 0xff] ^
+		      crc32_table[6][(lo >> 8) & 0xff] ^
+		      crc32_table[5][(lo >> 16) & 0xff] ^
+		      crc32_table[4][lo >> 24] ^
+		      crc32_table[3][hi & 0xff] ^
+		      crc32_table[2][(hi >> 8) & 0xff] ^
+		      crc32_table[1][(hi >> 16) & 0xff] ^
+		      crc32_table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = crc32_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
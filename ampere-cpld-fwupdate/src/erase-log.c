@@ -0,0 +1,138 @@
+/*
+Flash erase times per device, for the erase wait and for telemetry
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "lattice.h"
+#include "ast-jtag.h"
+#include "erase-log.h"
+
+extern int debug;
+
+/* jobs on other controllers share the log file */
+static pthread_mutex_t erase_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*************************************************************************************/
+/*
+ * one line per device:
+ * <node> <IDCODE> <count> <avg_us> <min_us> <max_us> <last_us> <bounds> <bound_us>
+ */
+
+static int erase_log_line(const char *line, char *name, u32 *id, struct cpld_erase_log *log)
+{
+	memset(log, 0, sizeof(*log));
+	if (sscanf(line, "%255s %x %u %u %u %u %u %u %u", name, id, &log->count, &log->avg_us,
+		   &log->min_us, &log->max_us, &log->last_us, &log->bounds, &log->bound_us) < 7)
+		return -1;
+
+	return 0;
+}
+
+/* cpld_erase_log_get: history of node/idcode into log, -1 if none */
+int cpld_erase_log_get(const char *node, u32 idcode, struct cpld_erase_log *log)
+{
+	struct cpld_erase_log entry;
+	char line[512], name[256];
+	int retval = -1;
+	u32 id;
+	FILE *fp;
+
+	pthread_mutex_lock(&erase_log_lock);
+	fp = fopen(CPLD_ERASE_LOG, "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			if ((erase_log_line(line, name, &id, &entry) == 0) &&
+			    !strcmp(name, node) && (id == idcode) &&
+			    (entry.count || entry.bound_us)) {
+				*log = entry;
+				retval = 0;
+			}
+		}
+		fclose(fp);
+	}
+	pthread_mutex_unlock(&erase_log_lock);
+
+	return retval;
+}
+
+/*
+ * cpld_erase_log_put: add an erase to the history of node/idcode, of us
+ * when measured, else of at most us
+ */
+int cpld_erase_log_put(const char *node, u32 idcode, unsigned int us, int measured)
+{
+	struct cpld_erase_log entry, log;
+	char line[512], name[256], tmp[] = CPLD_ERASE_LOG ".new";
+	FILE *in, *out;
+	int retval = 0;
+	u32 id;
+
+	memset(&log, 0, sizeof(log));
+
+	pthread_mutex_lock(&erase_log_lock);
+	if ((mkdir(CPLD_STATE_DIR, 0755) < 0) && (errno != EEXIST)) {
+		retval = -1;
+		goto out;
+	}
+
+	out = fopen(tmp, "w");
+	if (!out) {
+		retval = -1;
+		goto out;
+	}
+
+	//keep the other devices
+	in = fopen(CPLD_ERASE_LOG, "r");
+	if (in) {
+		while (fgets(line, sizeof(line), in)) {
+			if (erase_log_line(line, name, &id, &entry) < 0)
+				continue;
+			if (strcmp(name, node) || (id != idcode))
+				fputs(line, out);
+			else
+				log = entry;
+		}
+		fclose(in);
+	}
+
+	if (!measured) {
+		log.bounds++;
+		log.bound_us = us;
+	} else {
+		if (log.count == 0) {
+			log.avg_us = us;
+			log.min_us = us;
+			log.max_us = us;
+		} else {
+			log.avg_us = ((unsigned long long) log.avg_us * 7 + us) / 8;
+			if (us < log.min_us)
+				log.min_us = us;
+			if (us > log.max_us)
+				log.max_us = us;
+		}
+		log.last_us = us;
+		log.count++;
+		log.bound_us = 0;
+	}
+	fprintf(out, "%s 0x%08X %u %u %u %u %u %u %u\n", node, idcode, log.count,
+		log.avg_us, log.min_us, log.max_us, log.last_us, log.bounds, log.bound_us);
+	if (debug) printf("erase log: %s %u erases, avg %u us, min %u us, max %u us, "
+			  "%u at most %u us\n", node, log.count, log.avg_us, log.min_us,
+			  log.max_us, log.bounds, log.bound_us);
+
+	if (fclose(out) != 0)
+		retval = -1;
+	if ((retval == 0) && (rename(tmp, CPLD_ERASE_LOG) != 0))
+		retval = -1;
+out:
+	if (retval < 0)
+		fprintf(stderr, "Cannot write '%s': %d, %s\n", CPLD_ERASE_LOG, errno, strerror(errno));
+	pthread_mutex_unlock(&erase_log_lock);
+
+	return retval;
+}
@@ -0,0 +1,272 @@
+/*
+ * ASCII '0'/'1' fuse string to packed bits.
+ *
+ * Fuse characters are checked and packed 32 at a time with SSE2 or NEON, or
+ * 8 at a time in a 64-bit word otherwise. Anything that is not a fuse
+ * character (line breaks, the '*' field end) drops to the per character
+ * loop, which skips CR/LF and stops at the field end. JED_PACK_SCALAR
+ * builds the 64-bit word path on any target, for test/fuse-pack-test.c.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#if defined(JED_PACK_SCALAR)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define JED_PACK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define JED_PACK_NEON
+#endif
+#include "ast-jtag.h"
+#include "fuse-pack.h"
+
+/*************************************************************************************/
+
+#if defined(JED_PACK_SSE2)
+
+const char *jed_pack_kernel(void)
+{
+	return "SSE2";
+}
+
+/* 4 words of a and b equal */
+static inline int jed_cmp_4(const u32 *a, const u32 *b)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *) a);
+	__m128i y = _mm_loadu_si128((const __m128i *) b);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(x, y)) == 0xffff;
+}
+
+/* pack 32 fuse characters, -1 if any of them is not '0'/'1' */
+static inline int jed_pack_32(const char *src, u32 *bits)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i *) src);
+	__m128i hi = _mm_loadu_si128((const __m128i *) (src + 16));
+	__m128i mask = _mm_set1_epi8((char) 0xfe);
+	__m128i zero = _mm_set1_epi8('0');
+	__m128i one = _mm_set1_epi8('1');
+	int valid;
+
+	//'0' and '1' only differ in bit 0
+	valid = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, mask), zero)) &
+		_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(hi, mask), zero));
+	if (valid != 0xffff)
+		return -1;
+
+	*bits = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(lo, one)) |
+		((u32) _mm_movemask_epi8(_mm_cmpeq_epi8(hi, one)) << 16);
+
+	return 0;
+}
+
+#elif defined(JED_PACK_NEON)
+
+const char *jed_pack_kernel(void)
+{
+	return "NEON";
+}
+
+/* 4 words of a and b equal */
+static inline int jed_cmp_4(const u32 *a, const u32 *b)
+{
+	uint64x2_t eq = vreinterpretq_u64_u32(vceqq_u32(vld1q_u32(a), vld1q_u32(b)));
+
+	return (vgetq_lane_u64(eq, 0) & vgetq_lane_u64(eq, 1)) == ~0ULL;
+}
+
+/* 16 fuse characters to 16 bits: weight bit 0 of each lane, then add up */
+static inline u32 jed_pack_neon16(uint8x16_t v)
+{
+	static const int8_t shift[16] = { 0, 1, 2, 3, 4, 5, 6, 7,
+					  0, 1, 2, 3, 4, 5, 6, 7 };
+	uint8x16_t b;
+	uint64x2_t sum;
+
+	b = vshlq_u8(vandq_u8(v, vdupq_n_u8(1)), vld1q_s8(shift));
+	sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(b)));
+
+	return (u32) vgetq_lane_u64(sum, 0) | ((u32) vgetq_lane_u64(sum, 1) << 8);
+}
+
+/* pack 32 fuse characters, -1 if any of them is not '0'/'1' */
+static inline int jed_pack_32(const char *src, u32 *bits)
+{
+	uint8x16_t lo = vld1q_u8((const uint8_t *) src);
+	uint8x16_t hi = vld1q_u8((const uint8_t *) src + 16);
+	uint8x16_t mask = vdupq_n_u8(0xfe);
+	uint8x16_t zero = vdupq_n_u8('0');
+	uint64x2_t valid;
+
+	//'0' and '1' only differ in bit 0
+	valid = vreinterpretq_u64_u8(vandq_u8(vceqq_u8(vandq_u8(lo, mask), zero),
+					      vceqq_u8(vandq_u8(hi, mask), zero)));
+	if ((vgetq_lane_u64(valid, 0) & vgetq_lane_u64(valid, 1)) != ~0ULL)
+		return -1;
+
+	*bits = jed_pack_neon16(lo) | (jed_pack_neon16(hi) << 16);
+
+	return 0;
+}
+
+#else
+
+const char *jed_pack_kernel(void)
+{
+	return "scalar";
+}
+
+/* 4 words of a and b equal */
+static inline int jed_cmp_4(const u32 *a, const u32 *b)
+{
+	u64 x0, x1, y0, y1;
+
+	memcpy(&x0, a, sizeof(x0));
+	memcpy(&x1, a + 2, sizeof(x1));
+	memcpy(&y0, b, sizeof(y0));
+	memcpy(&y1, b + 2, sizeof(y1));
+
+	return ((x0 ^ y0) | (x1 ^ y1)) == 0;
+}
+
+/* pack 8 fuse characters held in a 64-bit word, -1 if not all '0'/'1' */
+static inline int jed_pack_8(const char *src, u32 *bits)
+{
+	u64 x;
+
+	memcpy(&x, src, sizeof(x));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	x = __builtin_bswap64(x);
+#endif
+	if ((x & 0xfefefefefefefefeULL) != 0x3030303030303030ULL)
+		return -1;
+
+	//gather bit 0 of byte i into bit 56 + i
+	*bits = (u32) (((x & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56);
+
+	return 0;
+}
+
+/* pack 32 fuse characters, -1 if any of them is not '0'/'1' */
+static inline int jed_pack_32(const char *src, u32 *bits)
+{
+	u32 b0, b1, b2, b3;
+
+	if ((jed_pack_8(src, &b0) < 0) || (jed_pack_8(src + 8, &b1) < 0) ||
+	    (jed_pack_8(src + 16, &b2) < 0) || (jed_pack_8(src + 24, &b3) < 0))
+		return -1;
+
+	*bits = b0 | (b1 << 8) | (b2 << 16) | (b3 << 24);
+
+	return 0;
+}
+
+#endif
+
+/* OR 32 packed fuses into dst at fuse position pos */
+static inline void jed_pack_put(u32 *dst, unsigned int pos, u32 bits)
+{
+	unsigned int sh = pos & 31;
+
+	dst[pos >> 5] |= bits << sh;
+	if (sh)
+		dst[(pos >> 5) + 1] |= bits >> (32 - sh);
+}
+
+/*
+ * JEDEC fuse checksum of 32 packed fuses at fuse position pos: fuse n adds
+ * 1 << (n % 8). Shifting by pos % 8 puts every fuse at its weight within a
+ * byte, so the contribution is the byte sum of the shifted value.
+ */
+static inline u32 jed_pack_sum(u32 bits, unsigned int pos)
+{
+	u64 x = (u64) bits << (pos & 7);
+
+	x = (x & 0x00ff00ff00ff00ffULL) + ((x >> 8) & 0x00ff00ff00ff00ffULL);
+	x = x + (x >> 16);
+	x = x + (x >> 32);
+
+	return (u32) (x & 0xffff);
+}
+
+/*
+ * jed_pack_fuses: pack fuse characters from src into dst.
+ * Packing starts at fuse position *pos, which is advanced; dst must be
+ * zeroed and hold max fuses. CR/LF, space and tab are skipped. Stops at the
+ * first other character, or once *pos reaches max. With dst NULL fuses are
+ * only counted. The JEDEC fuse checksum of the consumed fuses is added to
+ * *sum. Returns the characters consumed.
+ */
+size_t jed_pack_fuses(const char *src, size_t len, u32 *dst,
+		      unsigned int *pos, unsigned int max, u32 *sum)
+{
+	unsigned int p = *pos;
+	size_t i = 0;
+	u32 lo, hi, csum = 0;
+	char c;
+
+	while (i < len) {
+		if ((len - i >= 64) && (max - p >= 64) &&
+		    (jed_pack_32(&src[i], &lo) == 0) &&
+		    (jed_pack_32(&src[i + 32], &hi) == 0)) {
+			if (dst) {
+				jed_pack_put(dst, p, lo);
+				jed_pack_put(dst, p + 32, hi);
+			}
+			csum += jed_pack_sum(lo, p) + jed_pack_sum(hi, p + 32);
+			p += 64;
+			i += 64;
+			continue;
+		}
+		if ((len - i >= 32) && (max - p >= 32) &&
+		    (jed_pack_32(&src[i], &lo) == 0)) {
+			if (dst)
+				jed_pack_put(dst, p, lo);
+			csum += jed_pack_sum(lo, p);
+			p += 32;
+			i += 32;
+			continue;
+		}
+
+		c = src[i];
+		if ((c == '0') || (c == '1')) {
+			if (p == max)
+				break;
+			if (c == '1') {
+				if (dst)
+					dst[p >> 5] |= 1u << (p & 31);
+				csum += 1u << (p & 7);
+			}
+			p++;
+		} else if ((c != '\r') && (c != '\n') && (c != ' ') && (c != '\t')) {
+			break;
+		}
+		i++;
+	}
+
+	*pos = p;
+	*sum += csum;
+
+	return i;
+}
+
+/*
+ * jed_row_cmp: compare words of packed fuses, 4 words per step.
+ * Returns the index of the first differing word, -1 if a and b are equal.
+ */
+int jed_row_cmp(const u32 *a, const u32 *b, unsigned int words)
+{
+	unsigned int i = 0;
+
+	for (; i + 4 <= words; i += 4) {
+		if (!jed_cmp_4(&a[i], &b[i]))
+			break;
+	}
+	for (; i < words; i++) {
+		if (a[i] != b[i])
+			return i;
+	}
+
+	return -1;
+}
@@ -0,0 +1,436 @@
+/*
+Image file input, plain or gzip/xz/zstd compressed
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "ast-jtag.h"
+#include "jed-input.h"
+
+static const u8 gzip_magic[] = { 0x1F, 0x8B };
+static const u8 xz_magic[] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+static const u8 zstd_magic[] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+static const char *jed_input_names[] = {
+	[JED_INPUT_PLAIN] = "plain",
+	[JED_INPUT_GZIP] = "gzip",
+	[JED_INPUT_XZ] = "xz",
+	[JED_INPUT_ZSTD] = "zstd",
+};
+
+const char *jed_input_name(int format)
+{
+	return jed_input_names[format];
+}
+
+/*************************************************************************************/
+
+#if defined(HAVE_ZLIB) || defined(HAVE_LZMA) || defined(HAVE_ZSTD)
+/* jed_input_fill: read the next compressed chunk, 0 at the end of the file */
+static ssize_t jed_input_fill(struct jed_input *in)
+{
+	ssize_t len;
+
+	len = read(in->fd, in->buf, JED_INPUT_CHUNK);
+	if (len < 0) {
+		perror("read");
+		return -1;
+	}
+	if (len == 0)
+		in->eof = 1;
+
+	return len;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+static int gzip_open(struct jed_input *in)
+{
+	z_stream *z;
+
+	z = calloc(1, sizeof(*z));
+	if (!z)
+		return -1;
+	//15 + 32: gzip or zlib header, detected
+	if (inflateInit2(z, 15 + 32) != Z_OK) {
+		free(z);
+		return -1;
+	}
+	in->dec = z;
+
+	return 0;
+}
+
+static ssize_t gzip_read(struct jed_input *in, void *buf, size_t len)
+{
+	z_stream *z = in->dec;
+	ssize_t n;
+	int ret;
+
+	z->next_out = buf;
+	z->avail_out = len;
+	while ((z->avail_out == len) && !in->end) {
+		if (z->avail_in == 0) {
+			n = jed_input_fill(in);
+			if (n < 0)
+				return -1;
+			if (n == 0) {
+				printf("gzip Error - truncated input\n");
+				return -1;
+			}
+			z->next_in = in->buf;
+			z->avail_in = n;
+		}
+		ret = inflate(z, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			//another gzip member may follow, as with cat a.gz b.gz
+			if (z->avail_in == 0) {
+				n = jed_input_fill(in);
+				if (n < 0)
+					return -1;
+				z->next_in = in->buf;
+				z->avail_in = n;
+			}
+			if (z->avail_in == 0)
+				in->end = 1;
+			else
+				inflateReset(z);
+		} else if (ret != Z_OK) {
+			printf("gzip Error - %s\n", z->msg ? z->msg : "bad data");
+			return -1;
+		}
+	}
+
+	return len - z->avail_out;
+}
+
+static void gzip_close(struct jed_input *in)
+{
+	inflateEnd(in->dec);
+	free(in->dec);
+}
+#endif
+
+#ifdef HAVE_LZMA
+static int xz_open(struct jed_input *in)
+{
+	lzma_stream *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -1;
+	if (lzma_stream_decoder(s, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+		free(s);
+		return -1;
+	}
+	in->dec = s;
+
+	return 0;
+}
+
+static ssize_t xz_read(struct jed_input *in, void *buf, size_t len)
+{
+	lzma_stream *s = in->dec;
+	lzma_ret ret;
+	ssize_t n;
+
+	s->next_out = buf;
+	s->avail_out = len;
+	while ((s->avail_out == len) && !in->end) {
+		if ((s->avail_in == 0) && !in->eof) {
+			n = jed_input_fill(in);
+			if (n < 0)
+				return -1;
+			s->next_in = in->buf;
+			s->avail_in = n;
+		}
+		ret = lzma_code(s, in->eof ? LZMA_FINISH : LZMA_RUN);
+		if (ret == LZMA_STREAM_END) {
+			in->end = 1;
+		} else if (ret != LZMA_OK) {
+			printf("xz Error - %d\n", ret);
+			return -1;
+		}
+	}
+
+	return len - s->avail_out;
+}
+
+static void xz_close(struct jed_input *in)
+{
+	lzma_end(in->dec);
+	free(in->dec);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/**
+ * struct zstd_dec - zstd decoder and its input window:
+ *
+ * @ds: decompression stream
+ * @in: compressed bytes in jed_input.buf
+ * @frame: the last call ended inside a frame
+ */
+struct zstd_dec {
+	ZSTD_DStream	*ds;
+	ZSTD_inBuffer	in;
+	int		frame;
+};
+
+static int zstd_open(struct jed_input *in)
+{
+	struct zstd_dec *z;
+
+	z = calloc(1, sizeof(*z));
+	if (!z)
+		return -1;
+	z->ds = ZSTD_createDStream();
+	if (!z->ds) {
+		free(z);
+		return -1;
+	}
+	ZSTD_initDStream(z->ds);
+	z->in.src = in->buf;
+	in->dec = z;
+
+	return 0;
+}
+
+static ssize_t zstd_read(struct jed_input *in, void *buf, size_t len)
+{
+	struct zstd_dec *z = in->dec;
+	ZSTD_outBuffer out = { buf, len, 0 };
+	ssize_t n;
+	size_t ret;
+
+	while ((out.pos == 0) && !in->end) {
+		if (z->in.pos == z->in.size) {
+			n = jed_input_fill(in);
+			if (n < 0)
+				return -1;
+			if (n == 0) {
+				if (z->frame) {
+					printf("zstd Error - truncated input\n");
+					return -1;
+				}
+				in->end = 1;
+				break;
+			}
+			z->in.size = n;
+			z->in.pos = 0;
+		}
+		ret = ZSTD_decompressStream(z->ds, &out, &z->in);
+		if (ZSTD_isError(ret)) {
+			printf("zstd Error - %s\n", ZSTD_getErrorName(ret));
+			return -1;
+		}
+		//0: a frame is complete, more frames may follow
+		z->frame = (ret != 0);
+	}
+
+	return out.pos;
+}
+
+static void zstd_close(struct jed_input *in)
+{
+	struct zstd_dec *z = in->dec;
+
+	ZSTD_freeDStream(z->ds);
+	free(z);
+}
+#endif
+
+/* jed_input_decode: decompressed bytes from the file, 0 at the end */
+static ssize_t jed_input_decode(struct jed_input *in, void *buf, size_t len)
+{
+	ssize_t n;
+
+	switch (in->format) {
+#ifdef HAVE_ZLIB
+	case JED_INPUT_GZIP:
+		return gzip_read(in, buf, len);
+#endif
+#ifdef HAVE_LZMA
+	case JED_INPUT_XZ:
+		return xz_read(in, buf, len);
+#endif
+#ifdef HAVE_ZSTD
+	case JED_INPUT_ZSTD:
+		return zstd_read(in, buf, len);
+#endif
+	default:
+		n = read(in->fd, buf, len);
+		if (n < 0)
+			perror("read");
+		return n;
+	}
+}
+
+/*************************************************************************************/
+
+int jed_input_open(struct jed_input *in, const char *path)
+{
+	u8 magic[sizeof(xz_magic)];
+	ssize_t len;
+	int retval = 0;
+
+	memset(in, 0, sizeof(*in));
+	in->fd = open(path, O_RDONLY);
+	if (in->fd == -1) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+		return -1;
+	}
+
+	len = pread(in->fd, magic, sizeof(magic), 0);
+	if (len <= 0) {
+		fprintf(stderr, "Cannot read '%s'\n", path);
+		close(in->fd);
+		return -1;
+	}
+
+	if (((size_t) len >= sizeof(gzip_magic)) && !memcmp(magic, gzip_magic, sizeof(gzip_magic)))
+		in->format = JED_INPUT_GZIP;
+	else if (((size_t) len >= sizeof(xz_magic)) && !memcmp(magic, xz_magic, sizeof(xz_magic)))
+		in->format = JED_INPUT_XZ;
+	else if (((size_t) len >= sizeof(zstd_magic)) && !memcmp(magic, zstd_magic, sizeof(zstd_magic)))
+		in->format = JED_INPUT_ZSTD;
+	if (in->format == JED_INPUT_PLAIN)
+		return 0;
+
+	in->buf = malloc(JED_INPUT_CHUNK);
+	if (!in->buf) {
+		close(in->fd);
+		return -1;
+	}
+
+	switch (in->format) {
+#ifdef HAVE_ZLIB
+	case JED_INPUT_GZIP:
+		retval = gzip_open(in);
+		break;
+#endif
+#ifdef HAVE_LZMA
+	case JED_INPUT_XZ:
+		retval = xz_open(in);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case JED_INPUT_ZSTD:
+		retval = zstd_open(in);
+		break;
+#endif
+	default:
+		printf("'%s' is %s compressed, not supported by this build\n",
+		       path, jed_input_name(in->format));
+		retval = -1;
+		break;
+	}
+
+	if (retval < 0) {
+		free(in->buf);
+		close(in->fd);
+	}
+
+	return retval;
+}
+
+/*
+ * jed_input_peek: the first len bytes, at most JED_INPUT_PEEK, of the
+ * decompressed data. Call before the first jed_input_read().
+ */
+ssize_t jed_input_peek(struct jed_input *in, void *buf, size_t len)
+{
+	ssize_t n;
+
+	if (len > JED_INPUT_PEEK)
+		len = JED_INPUT_PEEK;
+
+	while (in->peek_len < len) {
+		n = jed_input_decode(in, &in->peek[in->peek_len], len - in->peek_len);
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		in->peek_len += n;
+	}
+
+	if (len > in->peek_len)
+		len = in->peek_len;
+	memcpy(buf, in->peek, len);
+
+	return len;
+}
+
+/* jed_input_read: up to len decompressed bytes, 0 at the end */
+ssize_t jed_input_read(struct jed_input *in, void *buf, size_t len)
+{
+	size_t n;
+
+	if (in->peek_pos < in->peek_len) {
+		n = in->peek_len - in->peek_pos;
+		if (n > len)
+			n = len;
+		memcpy(buf, &in->peek[in->peek_pos], n);
+		in->peek_pos += n;
+		return n;
+	}
+
+	return jed_input_decode(in, buf, len);
+}
+
+/* jed_input_read_full: len bytes unless the data ends before */
+ssize_t jed_input_read_full(struct jed_input *in, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = jed_input_read(in, (u8 *) buf + done, len - done);
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+
+	return done;
+}
+
+void jed_input_close(struct jed_input *in)
+{
+	switch (in->format) {
+#ifdef HAVE_ZLIB
+	case JED_INPUT_GZIP:
+		gzip_close(in);
+		break;
+#endif
+#ifdef HAVE_LZMA
+	case JED_INPUT_XZ:
+		xz_close(in);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case JED_INPUT_ZSTD:
+		zstd_close(in);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	free(in->buf);
+	close(in->fd);
+}
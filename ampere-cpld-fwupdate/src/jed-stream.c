@@ -0,0 +1,312 @@
+/*
+Pipelined JEDEC decode, a decoder thread feeding a ring of CFG rows
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "ast-jtag.h"
+#include "jedec.h"
+#include "jed-input.h"
+#include "jed-stream.h"
+#include "crc32.h"
+
+extern int debug;
+
+/*************************************************************************************/
+
+/* jed_stream_put: copy a row into the ring, waiting for a free slot */
+static int jed_stream_put(void *arg, const u32 *row)
+{
+	struct jed_stream *s = arg;
+
+	//the check pass only decodes
+	if (s->check)
+		return 0;
+
+	pthread_mutex_lock(&s->lock);
+	while ((s->head - s->tail == JED_STREAM_ROWS) && !s->abort)
+		pthread_cond_wait(&s->cond, &s->lock);
+	if (s->abort) {
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	//the slot at head is the decoder's until head moves on
+	memcpy(&s->ring[(s->head % JED_STREAM_ROWS) * s->words], row, s->words * sizeof(u32));
+
+	pthread_mutex_lock(&s->lock);
+	s->head++;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+
+	return 0;
+}
+
+/*
+ * jed_stream_image: rows of a pre-compiled image, read as they are. The
+ * last row is zero padded, the CRC-32 covers the CFG bits only.
+ */
+static int jed_stream_image(struct jed_stream *s, char *buf)
+{
+	struct jed_file *jed = s->jed;
+	size_t row_size = s->words * sizeof(u32);
+	size_t left = (jed->cfg_bits + 31) / 32 * sizeof(u32);
+	size_t crc_left = (jed->cfg_bits + 7) / 8;
+	size_t n;
+	u32 crc = 0;
+
+	while (left) {
+		n = left < row_size ? left : row_size;
+		memset(buf, 0, row_size);
+		if (jed_input_read_full(&s->in, buf, n) != (ssize_t) n) {
+			printf("Image Error - short fuse map\n");
+			return -1;
+		}
+		crc = crc32_update(crc, buf, n < crc_left ? n : crc_left);
+		crc_left -= n < crc_left ? n : crc_left;
+		if (jed_stream_put(s, (u32 *) buf) < 0)
+			return -1;
+		left -= n;
+	}
+
+	jed->crc32 = crc;
+	if (crc != s->image_crc) {
+		printf("Image Error - CRC32 0x%08X, expected 0x%08X\n", crc, s->image_crc);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* jed_stream_decode: decode the whole input, rows go to jed_stream_put() */
+static int jed_stream_decode(struct jed_stream *s)
+{
+	char *buf;
+	ssize_t len = 0;
+	int retval = -1;
+
+	buf = malloc(JED_STREAM_CHUNK);
+	if (buf) {
+		if (s->image) {
+			retval = jed_stream_image(s, buf);
+		} else {
+			retval = 0;
+			while ((len = jed_input_read(&s->in, buf, JED_STREAM_CHUNK)) > 0) {
+				if (jed_parse_feed(&s->parser, buf, len) < 0) {
+					retval = -1;
+					break;
+				}
+			}
+			if (len < 0)
+				retval = -1;
+			if (retval == 0)
+				retval = jed_parse_finish(&s->parser);
+		}
+		free(buf);
+	}
+
+	return retval;
+}
+
+static void *jed_stream_thread(void *arg)
+{
+	struct jed_stream *s = arg;
+	int retval;
+
+	retval = jed_stream_decode(s);
+	if ((retval == 0) && (s->jed->crc32 != s->check_crc)) {
+		printf("Image Error - CRC32 0x%08X, 0x%08X before erase, the file changed\n",
+		       s->jed->crc32, s->check_crc);
+		retval = -1;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->status = retval;
+	s->done = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+/*
+ * jed_stream_header: take the header of a pre-compiled image, so dev_id,
+ * usercode and cfg_bits are known before the first row.
+ */
+static int jed_stream_header(struct jed_stream *s, unsigned short dr_bits)
+{
+	struct cpld_image_header hdr;
+	struct jed_file *jed = s->jed;
+	char skip[64];
+	size_t left, n;
+
+	if (jed_input_read_full(&s->in, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		printf("Image Error - short header\n");
+		return -1;
+	}
+	if ((hdr.version != CPLD_IMAGE_VERSION) || (hdr.header_size < sizeof(hdr))) {
+		printf("Image Error - unsupported version %d\n", hdr.version);
+		return -1;
+	}
+	if ((hdr.cfg_bits == 0) || (hdr.dr_bits != dr_bits)) {
+		printf("Image Error - %d CFG bits, %d bits per row\n", hdr.cfg_bits, hdr.dr_bits);
+		return -1;
+	}
+	//a newer header may be longer, the fuse map follows it
+	left = hdr.header_size - sizeof(hdr);
+	while (left) {
+		n = left < sizeof(skip) ? left : sizeof(skip);
+		if (jed_input_read_full(&s->in, skip, n) != (ssize_t) n)
+			return -1;
+		left -= n;
+	}
+
+	jed->cfg_bits = hdr.cfg_bits;
+	jed->usercode = hdr.usercode;
+	jed->dev_id = hdr.dev_id;
+	jed->nsections = 1;
+	jed->section[0].bits = hdr.cfg_bits;
+	jed->section[0].offset = hdr.header_size;
+	s->image_crc = hdr.crc32;
+	s->image = 1;
+
+	return 0;
+}
+
+/* jed_stream_start: open path and set up a decode from its first row */
+static int jed_stream_start(struct jed_stream *s, const char *path, unsigned short dr_bits)
+{
+	u32 magic = 0;
+
+	s->image = 0;
+	if (jed_input_open(&s->in, path) < 0)
+		return -1;
+
+	jed_parse_init(&s->parser, s->jed);
+	if (jed_input_peek(&s->in, &magic, sizeof(magic)) != sizeof(magic)) {
+		fprintf(stderr, "Cannot read '%s'\n", path);
+		goto err;
+	}
+	if (magic == CPLD_IMAGE_MAGIC) {
+		if (jed_stream_header(s, dr_bits) < 0)
+			goto err;
+	} else if (jed_parse_rows(&s->parser, dr_bits, jed_stream_put, s) < 0) {
+		goto err;
+	}
+
+	return 0;
+err:
+	jed_file_free(s->jed);
+	jed_input_close(&s->in);
+	return -1;
+}
+
+/*
+ * jed_stream_open: check path, then start decoding it into rows of dr_bits.
+ * The check pass decodes the whole file and drops the rows, so a bad
+ * checksum, CRC-32 or fuse list fails here, before the device is erased.
+ * The fuse map in jed holds one row at most; jed is complete after
+ * jed_stream_close().
+ */
+int jed_stream_open(struct jed_stream *s, const char *path, struct jed_file *jed,
+		    unsigned short dr_bits)
+{
+	int retval;
+
+	memset(s, 0, sizeof(*s));
+	s->jed = jed;
+	s->words = dr_bits / 32;
+
+	s->check = 1;
+	if (jed_stream_start(s, path, dr_bits) < 0)
+		return -1;
+	retval = jed_stream_decode(s);
+	s->check_crc = jed->crc32;
+	jed_file_free(jed);
+	jed_input_close(&s->in);
+	s->check = 0;
+	if (retval < 0) {
+		printf("Image Error - '%s' failed its check, nothing erased or programmed\n", path);
+		return -1;
+	}
+
+	if (jed_stream_start(s, path, dr_bits) < 0)
+		return -1;
+
+	s->ring = malloc(JED_STREAM_ROWS * s->words * sizeof(u32));
+	if (!s->ring)
+		goto err;
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	if (pthread_create(&s->thread, NULL, jed_stream_thread, s)) {
+		printf("Cannot start the decoder thread\n");
+		goto err;
+	}
+	jed->stream = s;
+
+	if (debug) printf("JEDEC: decoding %s in a thread, %d row ring\n", path, JED_STREAM_ROWS);
+
+	return 0;
+err:
+	free(s->ring);
+	s->ring = NULL;
+	jed_file_free(jed);
+	jed_input_close(&s->in);
+	return -1;
+}
+
+/*
+ * jed_stream_next: the next CFG row, NULL after the last one or when the
+ * decoder failed. The row stays valid until jed_stream_release().
+ */
+u32 *jed_stream_next(struct jed_stream *s)
+{
+	u32 *row = NULL;
+
+	pthread_mutex_lock(&s->lock);
+	while ((s->head == s->tail) && !s->done)
+		pthread_cond_wait(&s->cond, &s->lock);
+	if (s->head != s->tail)
+		row = &s->ring[(s->tail % JED_STREAM_ROWS) * s->words];
+	pthread_mutex_unlock(&s->lock);
+
+	return row;
+}
+
+void jed_stream_release(struct jed_stream *s)
+{
+	pthread_mutex_lock(&s->lock);
+	s->tail++;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * jed_stream_close: stop the decoder if rows are left, wait for it and
+ * return its result. Safe to call again.
+ */
+int jed_stream_close(struct jed_stream *s)
+{
+	if (!s->ring)
+		return s->status;
+
+	pthread_mutex_lock(&s->lock);
+	if (!s->done)
+		s->abort = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+
+	pthread_join(s->thread, NULL);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	jed_input_close(&s->in);
+	free(s->ring);
+	s->ring = NULL;
+
+	return s->status;
+}
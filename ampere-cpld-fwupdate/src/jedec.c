@@ -0,0 +1,882 @@
+/*
+Please get the JEDEC file format before you read the code
+*/
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include "ast-jtag.h"
+#include "jedec.h"
+#include "fuse-pack.h"
+#include "crc32.h"
+#include "jed-input.h"
+
+extern int debug;
+
+#define JED_STX		0x02
+#define JED_ETX		0x03
+
+/* parser states */
+#define JED_STATE_FIELD		0	/* between fields */
+#define JED_STATE_TEXT		1	/* inside a non fuse field */
+#define JED_STATE_L_ADDR	2	/* L field address */
+#define JED_STATE_L_FUSE	3	/* L field fuse characters */
+#define JED_STATE_END		4	/* after ETX */
+
+/* initial CFG fuse map size when the file has no QF field */
+#define JED_FUSE_WORDS_INIT	4096
+
+/*************************************************************************************/
+
+static int jed_fuse_grow(struct jed_file *jed, unsigned int bits)
+{
+	unsigned int words;
+	u32 *fuse;
+
+	words = jed->fuse_words ? jed->fuse_words : JED_FUSE_WORDS_INIT;
+	if ((jed->fuse_words == 0) && (jed->qf_bits >= bits))
+		words = jed->qf_bits / 32 + 1;
+	while (words * 32 < bits)
+		words *= 2;
+
+	fuse = realloc(jed->fuse, words * sizeof(u32));
+	if (!fuse) {
+		printf("Out of memory for %d fuses\n", bits);
+		return -1;
+	}
+	memset(&fuse[jed->fuse_words], 0, (words - jed->fuse_words) * sizeof(u32));
+	jed->fuse = fuse;
+	jed->fuse_words = words;
+
+	return 0;
+}
+
+static void jed_parse_text(struct jed_parser *p)
+{
+	struct jed_file *jed = p->jed;
+	u32 usercode;
+	unsigned int qf, csum, fdef;
+	char *ptr;
+
+	p->text[p->text_len] = '\0';
+
+	switch (p->field) {
+	case 'N':
+		//NOTE END CONFIG DATA*
+		//L<cfg bit size>
+		if (strstr(p->text, "END CONFIG DATA"))
+			p->cfg_note = 1;
+		//NOTE User Electronic Signature Data*
+		//UH<usercode>*
+		if (strstr(p->text, "User Electronic Signature"))
+			p->ues_note = 1;
+		//NOTE DEVICE NAME:	LCMXO2-4000HC-4TQFP144*
+		ptr = strstr(p->text, "DEVICE NAME:");
+		if (ptr)
+			sscanf(ptr + strlen("DEVICE NAME:"), "%31s", jed->device);
+		break;
+	case 'Q':
+		if (sscanf(p->text, "QF%u", &qf) == 1)
+			jed->qf_bits = qf;
+		break;
+	case 'F':
+		//F<default fuse state>*
+		if (sscanf(p->text, "F%u", &fdef) == 1)
+			p->fuse_default = fdef & 1;
+		break;
+	case 'C':
+		//C<fuse checksum>*
+		if (sscanf(p->text, "C%4X", &csum) == 1) {
+			jed->file_csum = csum;
+			jed->has_csum = 1;
+		}
+		break;
+	case 'U':
+		if (sscanf(p->text, "UH%08X", &usercode) == 1) {
+			if (p->ues_note || (jed->usercode_offset == 0)) {
+				jed->usercode = usercode;
+				jed->usercode_offset = p->offset - p->text_len;
+			}
+			p->ues_note = 0;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * jed_parse_crc: run the CRC-32 over the CFG fuse map up to byte end. Only
+ * completely packed words are passed in while parsing, the tail is added by
+ * jed_parse_finish().
+ */
+static void jed_parse_crc(struct jed_parser *p, size_t end)
+{
+	if (end <= p->crc_bytes)
+		return;
+
+	p->crc = crc32_update(p->crc, (u8 *) p->jed->fuse + p->crc_bytes, end - p->crc_bytes);
+	p->crc_bytes = end;
+}
+
+/*
+ * jed_parse_row: hand the row packed in the fuse map to the row sink and
+ * start the next one. The CRC-32 runs over the rows as they go.
+ */
+static int jed_parse_row(struct jed_parser *p)
+{
+	struct jed_file *jed = p->jed;
+
+	jed_parse_crc(p, (jed->fuse_bits + 7) / 8);
+	if (p->row_fn(p->row_arg, jed->fuse) < 0)
+		return -1;
+	p->rows++;
+
+	memset(jed->fuse, 0, jed->fuse_words * sizeof(u32));
+	jed->fuse_bits = 0;
+	p->crc_bytes = 0;
+
+	return 0;
+}
+
+/* jed_cfg_addr: fuse address the CFG map is packed up to */
+static unsigned int jed_cfg_addr(struct jed_parser *p)
+{
+	return p->rows * p->jed->fuse_words * 32 + p->jed->fuse_bits;
+}
+
+/* jed_default_sum: fuse checksum of the unlisted fuses from addr to end */
+static u32 jed_default_sum(struct jed_parser *p, unsigned int addr, unsigned int end)
+{
+	u32 sum = 0;
+
+	if (!p->fuse_default || (addr >= end))
+		return 0;
+
+	for (; (addr < end) && (addr & 7); addr++)
+		sum += 1u << (addr & 7);
+	sum += (end - addr) / 8 * 0xff;
+	for (addr += (end - addr) / 8 * 8; addr < end; addr++)
+		sum += 1u << (addr & 7);
+
+	return sum;
+}
+
+/*
+ * jed_parse_fill: set the CFG map up to fuse address end to the F default,
+ * growing it or passing rows on as the fuse lists do.
+ */
+static int jed_parse_fill(struct jed_parser *p, unsigned int end)
+{
+	struct jed_file *jed = p->jed;
+	unsigned int addr;
+
+	while ((addr = jed_cfg_addr(p)) < end) {
+		if (jed->fuse_bits == jed->fuse_words * 32) {
+			if (p->row_fn) {
+				if (jed_parse_row(p) < 0)
+					return -1;
+			} else if (jed_fuse_grow(jed, jed->fuse_bits + 1) < 0) {
+				return -1;
+			}
+			continue;
+		}
+		if (p->fuse_default) {
+			jed->fuse[jed->fuse_bits >> 5] |= 1u << (jed->fuse_bits & 31);
+			p->csum += 1u << (addr & 7);
+		}
+		jed->fuse_bits++;
+	}
+	jed_parse_crc(p, (jed->fuse_bits / 32) * sizeof(u32));
+	p->next_addr = end;
+
+	return 0;
+}
+
+/*
+ * jed_parse_cfg_end: the CFG data is over at fuse address end, default the
+ * rest of the map and pass on its last row.
+ */
+static int jed_parse_cfg_end(struct jed_parser *p, unsigned int end)
+{
+	if (jed_parse_fill(p, end) < 0)
+		return -1;
+	if (p->row_fn && p->jed->fuse_bits && (jed_parse_row(p) < 0))
+		return -1;
+	p->cfg_end = 1;
+
+	return 0;
+}
+
+/*
+ * jed_parse_l_start: an L field starts at p->addr. Unlisted fuses before it
+ * take the F default, in the CFG map or in the checksum only.
+ */
+static int jed_parse_l_start(struct jed_parser *p)
+{
+	struct jed_file *jed = p->jed;
+
+	if (p->addr < p->next_addr) {
+		printf("File Error - fuse list L%u overlaps or is out of order, fuse %u already listed\n",
+		       p->addr, p->next_addr - 1);
+		return -1;
+	}
+
+	if (p->cfg_note) {
+		jed->cfg_bits = p->addr;
+		p->cfg_note = 0;
+		if (!p->cfg_end && (jed_parse_cfg_end(p, p->addr) < 0))
+			return -1;
+	}
+	if (!p->cfg_end) {
+		if (jed_parse_fill(p, p->addr) < 0)
+			return -1;
+	} else {
+		p->csum += jed_default_sum(p, p->next_addr, p->addr);
+		p->next_addr = p->addr;
+	}
+
+	if (jed->nsections < JED_MAX_SECTIONS) {
+		jed->section[jed->nsections].addr = p->addr;
+		jed->section[jed->nsections].bits = 0;
+		jed->section[jed->nsections].offset = p->offset;
+	}
+	jed->nsections++;
+
+	return 0;
+}
+
+/*
+ * jed_parse_fuses: consume the fuse characters and line breaks at the start
+ * of src. The fuse lists before "END CONFIG DATA" are packed into the CFG
+ * fuse map, growing it as needed, or row by row with a row sink; the others
+ * are only counted.
+ */
+static ssize_t jed_parse_fuses(struct jed_parser *p, const char *src, size_t len)
+{
+	struct jed_file *jed = p->jed;
+	struct jed_section *sec = NULL;
+	unsigned int bits;
+	size_t used = 0;
+
+	if (jed->nsections <= JED_MAX_SECTIONS)
+		sec = &jed->section[jed->nsections - 1];
+
+	for (;;) {
+		if (!p->cfg_end) {
+			if (jed->fuse_bits == jed->fuse_words * 32) {
+				if (p->row_fn) {
+					if (jed_parse_row(p) < 0)
+						return -1;
+				} else if (jed_fuse_grow(jed, jed->fuse_bits + 1) < 0) {
+					return -1;
+				}
+			}
+			bits = jed->fuse_bits;
+			used += jed_pack_fuses(&src[used], len - used, jed->fuse,
+					       &jed->fuse_bits, jed->fuse_words * 32, &p->csum);
+			bits = jed->fuse_bits - bits;
+			jed_parse_crc(p, (jed->fuse_bits / 32) * sizeof(u32));
+			p->next_addr = jed_cfg_addr(p);
+		} else {
+			//fuse addresses go on from the L field address
+			bits = p->addr;
+			used += jed_pack_fuses(&src[used], len - used, NULL, &bits, ~0u, &p->csum);
+			bits -= p->addr;
+			p->addr += bits;
+			p->next_addr = p->addr;
+		}
+		if (sec)
+			sec->bits += bits;
+
+		//stopped because the fuse map is full, grow it and go on
+		if ((used < len) && !p->cfg_end &&
+		    (jed->fuse_bits == jed->fuse_words * 32))
+			continue;
+
+		return used;
+	}
+}
+
+void jed_parse_init(struct jed_parser *p, struct jed_file *jed)
+{
+	memset(jed, 0, sizeof(*jed));
+	memset(p, 0, sizeof(*p));
+	p->jed = jed;
+	p->state = JED_STATE_FIELD;
+}
+
+/*
+ * jed_parse_rows: after jed_parse_init(), pass the CFG fuses to row_fn a
+ * row of dr_bits at a time instead of keeping the whole fuse map.
+ */
+int jed_parse_rows(struct jed_parser *p, unsigned short dr_bits,
+		   int (*row_fn)(void *arg, const u32 *row), void *arg)
+{
+	struct jed_file *jed = p->jed;
+
+	jed->fuse_words = dr_bits / 32;
+	jed->fuse = calloc(jed->fuse_words, sizeof(u32));
+	if (!jed->fuse) {
+		jed->fuse_words = 0;
+		return -1;
+	}
+	p->row_fn = row_fn;
+	p->row_arg = arg;
+
+	return 0;
+}
+
+int jed_parse_feed(struct jed_parser *p, const char *buf, size_t len)
+{
+	size_t i;
+	ssize_t n;
+	char c;
+
+	if (p->error)
+		return -1;
+
+	for (i = 0; i < len; i++, p->offset++) {
+		c = buf[i];
+
+		if (p->state == JED_STATE_END)
+			break;
+		if (c == JED_STX) {
+			//anything before STX is not part of the fuse file
+			p->state = JED_STATE_FIELD;
+			p->cfg_note = 0;
+			p->ues_note = 0;
+			continue;
+		}
+		if (c == JED_ETX) {
+			p->state = JED_STATE_END;
+			break;
+		}
+
+		switch (p->state) {
+		case JED_STATE_FIELD:
+			if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '*'))
+				break;
+			p->field = c;
+			if (c == 'L') {
+				p->addr = 0;
+				p->state = JED_STATE_L_ADDR;
+			} else {
+				p->text[0] = c;
+				p->text_len = 1;
+				p->state = JED_STATE_TEXT;
+			}
+			break;
+		case JED_STATE_TEXT:
+			if (c == '*') {
+				jed_parse_text(p);
+				p->state = JED_STATE_FIELD;
+			} else if (p->text_len < JED_FIELD_MAX - 1) {
+				p->text[p->text_len++] = c;
+			}
+			break;
+		case JED_STATE_L_ADDR:
+			if ((c >= '0') && (c <= '9')) {
+				p->addr = p->addr * 10 + (c - '0');
+				break;
+			}
+			if (jed_parse_l_start(p) < 0) {
+				p->error = 1;
+				return -1;
+			}
+			p->state = JED_STATE_L_FUSE;
+			/* fall through */
+		case JED_STATE_L_FUSE:
+			n = jed_parse_fuses(p, &buf[i], len - i);
+			if (n < 0) {
+				p->error = 1;
+				return -1;
+			}
+			if (n > 0) {
+				//the loop steps over the last consumed character
+				i += n - 1;
+				p->offset += n - 1;
+			} else if (c == '*') {
+				//a row is passed on once the next fuse needs its space or the
+				//CFG data ends, the next L field may still be CFG data
+				p->state = JED_STATE_FIELD;
+			} else {
+				printf("paser error [%x : %c] at offset %zu\n", c, c, p->offset);
+				p->error = 1;
+				return -1;
+			}
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int jed_parse_finish(struct jed_parser *p)
+{
+	struct jed_file *jed = p->jed;
+	unsigned int fuse_bits;
+
+	if (p->error)
+		return -1;
+
+	if (jed->nsections == 0) {
+		printf("File Error - no fuse data\n");
+		return -1;
+	}
+
+	//no "END CONFIG DATA" note, every fuse list is CFG data
+	if (!p->cfg_end && (jed_parse_cfg_end(p, p->next_addr) < 0))
+		return -1;
+	//the rest of the QF fuses is not listed
+	if (jed->qf_bits > p->next_addr)
+		p->csum += jed_default_sum(p, p->next_addr, jed->qf_bits);
+
+	//rows already passed on are not in the fuse map
+	fuse_bits = jed->fuse_bits;
+	if (p->row_fn)
+		fuse_bits += p->rows * jed->fuse_words * 32;
+
+	if (jed->cfg_bits == 0) {
+		//no "END CONFIG DATA" note, the first fuse list is the CFG data
+		jed->cfg_bits = fuse_bits;
+	}
+
+	if (jed->cfg_bits > fuse_bits) {
+		printf("File Error - bit_cnt %d, len %d\n", fuse_bits, jed->cfg_bits);
+		return -1;
+	}
+
+	//a CFG size below the first fuse list (not seen in Lattice files)
+	//needs the CRC from the start, rows passed on cover the whole list
+	if (!p->row_fn) {
+		if (p->crc_bytes > (jed->cfg_bits + 7) / 8) {
+			p->crc = 0;
+			p->crc_bytes = 0;
+		}
+		jed_parse_crc(p, (jed->cfg_bits + 7) / 8);
+	}
+	jed->crc32 = p->crc;
+
+	jed->csum = p->csum & 0xffff;
+	if (jed->has_csum && (jed->csum != jed->file_csum)) {
+		printf("File Error - fuse checksum 0x%04X, file says 0x%04X\n",
+		       jed->csum, jed->file_csum);
+		return -1;
+	}
+
+	if (debug) printf("JEDEC: %d fuse lists, CFG %d bits, QF %d, %s fuse packing, checksum 0x%04X%s, CRC32 0x%08X\n",
+			  jed->nsections, jed->cfg_bits, jed->qf_bits, jed_pack_kernel(),
+			  jed->csum, jed->has_csum ? "" : " (no C field)", jed->crc32);
+
+	return 0;
+}
+
+/*
+ * jed_image_read: take the fuse map of a pre-compiled image, no parsing.
+ */
+static int jed_image_read(struct jed_file *jed, const char *map, size_t size)
+{
+	struct cpld_image_header hdr;
+	size_t fuse_size;
+
+	memset(jed, 0, sizeof(*jed));
+	if (size < sizeof(hdr)) {
+		printf("Image Error - short header\n");
+		return -1;
+	}
+	memcpy(&hdr, map, sizeof(hdr));
+
+	if ((hdr.version != CPLD_IMAGE_VERSION) || (hdr.header_size < sizeof(hdr))) {
+		printf("Image Error - unsupported version %d\n", hdr.version);
+		return -1;
+	}
+
+	fuse_size = (hdr.cfg_bits + 31) / 32 * sizeof(u32);
+	if ((hdr.cfg_bits == 0) || (size < hdr.header_size + fuse_size)) {
+		printf("Image Error - %zu bytes, %d CFG bits\n", size, hdr.cfg_bits);
+		return -1;
+	}
+
+	jed->fuse = malloc(fuse_size);
+	if (!jed->fuse) {
+		printf("Out of memory for %d fuses\n", hdr.cfg_bits);
+		return -1;
+	}
+	memcpy(jed->fuse, map + hdr.header_size, fuse_size);
+	jed->fuse_words = fuse_size / sizeof(u32);
+	jed->fuse_bits = hdr.cfg_bits;
+	jed->cfg_bits = hdr.cfg_bits;
+	jed->usercode = hdr.usercode;
+	jed->dev_id = hdr.dev_id;
+	jed->nsections = 1;
+	jed->section[0].addr = 0;
+	jed->section[0].bits = hdr.cfg_bits;
+	jed->section[0].offset = hdr.header_size;
+
+	jed->crc32 = crc32_update(0, jed->fuse, (jed->cfg_bits + 7) / 8);
+	if (jed->crc32 != hdr.crc32) {
+		printf("Image Error - CRC32 0x%08X, expected 0x%08X\n", jed->crc32, hdr.crc32);
+		return -1;
+	}
+
+	if (debug) printf("Image: IDCODE 0x%08X, %d rows x %d bits\n",
+			  hdr.dev_id, hdr.row_num, hdr.dr_bits);
+
+	return 0;
+}
+
+/*
+ * jed_image_write: store a parsed JEDEC file as a pre-compiled image.
+ */
+int jed_image_write(const char *path, struct jed_file *jed, u32 dev_id,
+		    unsigned int row_num, unsigned short dr_bits)
+{
+	struct cpld_image_header hdr;
+	size_t fuse_size;
+	FILE *fp;
+	int retval = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CPLD_IMAGE_MAGIC;
+	hdr.version = CPLD_IMAGE_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.dev_id = dev_id;
+	hdr.usercode = jed->usercode;
+	hdr.row_num = row_num;
+	hdr.dr_bits = dr_bits;
+	hdr.cfg_bits = jed->cfg_bits;
+	hdr.crc32 = jed->crc32;
+	fuse_size = (jed->cfg_bits + 31) / 32 * sizeof(u32);
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+		return -1;
+	}
+	if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+	    (fwrite(jed->fuse, fuse_size, 1, fp) != 1)) {
+		fprintf(stderr, "Cannot write '%s': %d, %s\n", path, errno, strerror(errno));
+		retval = -1;
+	}
+	if (fclose(fp) != 0)
+		retval = -1;
+
+	return retval;
+}
+
+/*************************************************************************************/
+/*				READBACK OUTPUT					*/
+
+/* jed_writer_put: write len characters, summed into the transmission checksum */
+static int jed_writer_put(struct jed_writer *w, const char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		w->xsum += (unsigned char) buf[i];
+
+	return (fwrite(buf, 1, len, w->fp) == len) ? 0 : -1;
+}
+
+static int jed_writer_printf(struct jed_writer *w, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int jed_writer_printf(struct jed_writer *w, const char *fmt, ...)
+{
+	char line[JED_FIELD_MAX];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if ((len < 0) || ((size_t) len >= sizeof(line)))
+		return -1;
+
+	return jed_writer_put(w, line, len);
+}
+
+/* jed_writer_header: image header, rewritten with the final values on close */
+static int jed_writer_header(struct jed_writer *w)
+{
+	struct cpld_image_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CPLD_IMAGE_MAGIC;
+	hdr.version = CPLD_IMAGE_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.dev_id = w->dev_id;
+	hdr.usercode = w->usercode;
+	hdr.row_num = w->rows;
+	hdr.dr_bits = w->dr_bits;
+	hdr.cfg_bits = w->rows * w->dr_bits;
+	hdr.crc32 = w->crc;
+
+	if (fseek(w->fp, 0, SEEK_SET) != 0)
+		return -1;
+
+	return (fwrite(&hdr, sizeof(hdr), 1, w->fp) == 1) ? 0 : -1;
+}
+
+/*
+ * jed_writer_open: start a readback file of rows rows, a JEDEC file when
+ * path ends in ".jed", else a pre-compiled image that -p/-v take back.
+ */
+int jed_writer_open(struct jed_writer *w, const char *path, const char *device,
+		    u32 dev_id, unsigned int rows, unsigned short dr_bits)
+{
+	char tmp[sizeof(w->path) + 4];
+	size_t len = strlen(path);
+	int retval;
+
+	memset(w, 0, sizeof(*w));
+	if (len >= sizeof(w->path)) {
+		printf("Output file name too long\n");
+		return -1;
+	}
+	strcpy(w->path, path);
+	w->jedec = (len > 4) && !strcasecmp(path + len - 4, ".jed");
+	w->dev_id = dev_id;
+	w->rows = rows;
+	w->dr_bits = dr_bits;
+
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	w->fp = fopen(tmp, "wb");
+	if (!w->fp) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n", tmp, errno, strerror(errno));
+		return -1;
+	}
+
+	if (w->jedec) {
+		w->xsum = JED_STX;
+		retval = fputc(JED_STX, w->fp) == EOF ? -1 : 0;
+		if (retval == 0)
+			retval = jed_writer_printf(w, "NOTE ampere-cpld-fwupdate readback*\r\n"
+						   "NOTE DEVICE NAME:\t%s*\r\n"
+						   "QF%u*\r\nG0*\r\nF0*\r\nL000000\r\n",
+						   device, rows * dr_bits);
+	} else {
+		retval = jed_writer_header(w);
+	}
+
+	if (retval < 0) {
+		fprintf(stderr, "Cannot write '%s': %d, %s\n", tmp, errno, strerror(errno));
+		fclose(w->fp);
+		unlink(tmp);
+		w->fp = NULL;
+	}
+
+	return retval;
+}
+
+/*
+ * jed_writer_rows: append count rows, packed as struct jed_file holds them.
+ * The JEDEC fuse checksum adds each fuse as 1 << (address & 7), rows start
+ * on a byte boundary so that is the sum of the packed bytes.
+ */
+int jed_writer_rows(struct jed_writer *w, const u32 *buf, unsigned int count)
+{
+	unsigned int words = w->dr_bits / 32;
+	unsigned int n, i, b;
+	char line[JED_FIELD_MAX * 4];
+	u32 word;
+
+	if (count > w->rows - w->row)
+		return -1;
+
+	w->crc = crc32_update(w->crc, buf, count * words * sizeof(u32));
+	for (i = 0; i < count * words; i++) {
+		word = buf[i];
+		w->csum += (word & 0xff) + ((word >> 8) & 0xff) +
+			   ((word >> 16) & 0xff) + (word >> 24);
+	}
+
+	if (!w->jedec) {
+		w->row += count;
+		return (fwrite(buf, count * words * sizeof(u32), 1, w->fp) == 1) ? 0 : -1;
+	}
+
+	for (n = 0; n < count; n++, w->row++) {
+		for (b = 0; b < w->dr_bits; b++)
+			line[b] = '0' + ((buf[n * words + b / 32] >> (b % 32)) & 1);
+		//the last row closes the fuse list
+		if (w->row == w->rows - 1)
+			line[b++] = '*';
+		line[b++] = '\r';
+		line[b++] = '\n';
+		if (jed_writer_put(w, line, b) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * jed_writer_close: finish the file and move it in place with keep, drop
+ * it otherwise.
+ */
+int jed_writer_close(struct jed_writer *w, int keep)
+{
+	char tmp[sizeof(w->path) + 4];
+	int retval = 0;
+
+	if (!w->fp)
+		return -1;
+	snprintf(tmp, sizeof(tmp), "%s.new", w->path);
+
+	if (keep && (w->row != w->rows)) {
+		printf("Readback stopped at row %d of %d\n", w->row, w->rows);
+		keep = 0;
+	}
+
+	if (keep && w->jedec) {
+		retval = jed_writer_printf(w, "NOTE END CONFIG DATA*\r\n"
+					   "NOTE User Electronic Signature Data*\r\n"
+					   "UH%08X*\r\nC%04X*\r\n",
+					   w->usercode, w->csum & 0xffff);
+		w->xsum += JED_ETX;
+		if ((retval == 0) && (fprintf(w->fp, "%c%04X\r\n", JED_ETX, w->xsum) < 0))
+			retval = -1;
+	} else if (keep) {
+		retval = jed_writer_header(w);
+	}
+
+	if (fclose(w->fp) != 0)
+		retval = -1;
+	w->fp = NULL;
+
+	if (keep && (retval == 0) && (rename(tmp, w->path) != 0))
+		retval = -1;
+	if (keep && (retval < 0))
+		fprintf(stderr, "Cannot write '%s': %d, %s\n", w->path, errno, strerror(errno));
+	if (!keep || (retval < 0)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	printf("Readback : %d rows, usercode 0x%08X, CRC32 0x%08X -> %s\n",
+	       w->rows, w->usercode, w->crc, w->path);
+
+	return 0;
+}
+
+/*
+ * jed_file_decode: parse a compressed JEDEC file chunk by chunk as it is
+ * decompressed; a compressed pre-compiled image is taken in whole.
+ */
+static int jed_file_decode(struct jed_input *in, struct jed_file *jed)
+{
+	struct jed_parser parser;
+	char *buf, *tmp;
+	size_t size = 0, alloc = JED_INPUT_CHUNK;
+	ssize_t len;
+	u32 magic = 0;
+	int retval = 0;
+
+	if (jed_input_peek(in, &magic, sizeof(magic)) < 0)
+		return -1;
+
+	buf = malloc(alloc);
+	if (!buf)
+		return -1;
+
+	if (magic == CPLD_IMAGE_MAGIC) {
+		while ((len = jed_input_read(in, buf + size, alloc - size)) > 0) {
+			size += len;
+			if (size < alloc)
+				continue;
+			alloc *= 2;
+			tmp = realloc(buf, alloc);
+			if (!tmp) {
+				len = -1;
+				break;
+			}
+			buf = tmp;
+		}
+		retval = len < 0 ? -1 : jed_image_read(jed, buf, size);
+	} else {
+		jed_parse_init(&parser, jed);
+		while ((len = jed_input_read(in, buf, alloc)) > 0) {
+			if (jed_parse_feed(&parser, buf, len) < 0)
+				break;
+		}
+		retval = (len == 0) ? jed_parse_finish(&parser) : -1;
+	}
+	free(buf);
+
+	if (debug) printf("JEDEC: %s compressed input\n", jed_input_name(in->format));
+
+	return retval;
+}
+
+/*
+ * jed_file_load: parse a JEDEC file in one pass over an mmap of it, or take
+ * a pre-compiled image as is. Compressed files go through jed_file_decode().
+ */
+int jed_file_load(const char *path, struct jed_file *jed)
+{
+	struct jed_parser parser;
+	struct jed_input in;
+	struct stat st;
+	char *map;
+	int fd, retval;
+
+	if (jed_input_open(&in, path) < 0)
+		return -1;
+
+	if (in.format != JED_INPUT_PLAIN) {
+		retval = jed_file_decode(&in, jed);
+		jed_input_close(&in);
+		if (retval < 0)
+			jed_file_free(jed);
+		return retval;
+	}
+	fd = in.fd;
+
+	if ((fstat(fd, &st) == -1) || (st.st_size == 0)) {
+		fprintf(stderr, "Cannot read '%s'\n", path);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Cannot map '%s': %d, %s\n", path, errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	if (((size_t) st.st_size >= sizeof(u32)) && (*(u32 *) map == CPLD_IMAGE_MAGIC)) {
+		retval = jed_image_read(jed, map, st.st_size);
+	} else {
+		jed_parse_init(&parser, jed);
+		retval = jed_parse_feed(&parser, map, st.st_size);
+		if (retval == 0)
+			retval = jed_parse_finish(&parser);
+	}
+
+	munmap(map, st.st_size);
+	close(fd);
+
+	if (retval < 0)
+		jed_file_free(jed);
+
+	return retval;
+}
+
+void jed_file_free(struct jed_file *jed)
+{
+	free(jed->fuse);
+	jed->fuse = NULL;
+	jed->fuse_words = 0;
+}
@@ -0,0 +1,89 @@
+/*
+Programming checkpoint journal, one file per JTAG node
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lattice.h"
+#include "ast-jtag.h"
+#include "journal.h"
+
+extern int debug;
+
+/* journal_path: CPLD_STATE_DIR/journal-<node>, '/' and ':' in node as '_' */
+static void journal_path(const char *node, char *path, size_t size)
+{
+	char *p;
+
+	snprintf(path, size, "%s/journal-%s", CPLD_STATE_DIR, node);
+	for (p = path + strlen(CPLD_STATE_DIR) + 1; *p; p++) {
+		if ((*p == '/') || (*p == ':'))
+			*p = '_';
+	}
+}
+
+int cpld_journal_load(const char *node, struct cpld_journal *j)
+{
+	char path[512];
+	int fd;
+	ssize_t len;
+
+	journal_path(node, path, sizeof(path));
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	len = read(fd, j, sizeof(*j));
+	close(fd);
+
+	if ((len != sizeof(*j)) || (j->magic != CPLD_JOURNAL_MAGIC) ||
+	    (j->version != CPLD_JOURNAL_VERSION) || (j->size != sizeof(*j))) {
+		printf("Journal '%s' is not valid, ignored\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * cpld_journal_save: write the journal to a new file, sync it and move it
+ * over the old one, so a reset leaves either journal complete.
+ */
+int cpld_journal_save(const char *node, const struct cpld_journal *j)
+{
+	char path[512], tmp[520];
+	int fd, retval = 0;
+
+	if ((mkdir(CPLD_STATE_DIR, 0755) < 0) && (errno != EEXIST))
+		goto err;
+
+	journal_path(node, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		goto err;
+	if ((write(fd, j, sizeof(*j)) != sizeof(*j)) || (fsync(fd) < 0))
+		retval = -1;
+	if (close(fd) < 0)
+		retval = -1;
+	if ((retval == 0) && (rename(tmp, path) == 0))
+		return 0;
+	unlink(tmp);
+err:
+	fprintf(stderr, "Cannot write the journal: %d, %s\n", errno, strerror(errno));
+
+	return -1;
+}
+
+void cpld_journal_clear(const char *node)
+{
+	char path[512];
+
+	journal_path(node, path, sizeof(path));
+	if ((unlink(path) < 0) && (errno != ENOENT))
+		fprintf(stderr, "Cannot remove '%s': %d, %s\n", path, errno, strerror(errno));
+}
@@ -0,0 +1,257 @@
+/*
+JTAG clock auto-tuning with IDCODE and BYPASS loopback probes
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "lattice.h"
+#include "ast-jtag.h"
+#include "jtag-freq.h"
+
+extern int debug;
+
+/* 32-bit BYPASS scans per probe round, short enough for any driver */
+#define FREQ_BYPASS_SCANS	16
+
+/* jobs on other controllers share the cache file */
+static pthread_mutex_t freq_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*************************************************************************************/
+
+/* xorshift32 */
+static u32 freq_prbs(u32 *state)
+{
+	u32 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+/* BYPASS returns TDI delay bits later, one bit per device on the chain */
+static int freq_bypass_ok(u32 tdi, u32 tdo, unsigned int delay)
+{
+	return (tdo >> delay) == (tdi & (~0u >> delay));
+}
+
+static int freq_bypass_scan(u32 tdi, u32 *tdo)
+{
+	u32 ir = BYPASS;
+
+	//SIR 8 TDI (FF);
+	if (ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, &ir, &ir) < 0)
+		return -1;
+	//SDR 32 TDI (prbs);
+	*tdo = tdi;
+	return ast_jtag_sdr_xfer(JTAG_READ_XFER | JTAG_WRITE_XFER, 0, 32, tdo);
+}
+
+/* freq_bypass_delay: BYPASS bits between TDI and TDO, -1 if none fits */
+static int freq_bypass_delay(void)
+{
+	u32 seed = 0x9E3779B9, tdi, tdo;
+	int delay;
+
+	tdi = freq_prbs(&seed);
+	if (freq_bypass_scan(tdi, &tdo) < 0)
+		return -1;
+
+	for (delay = 1; delay <= JTAG_CHAIN_MAX + 1; delay++) {
+		if (freq_bypass_ok(tdi, tdo, delay))
+			return delay;
+	}
+
+	return -1;
+}
+
+/*
+ * freq_probe: JTAG_FREQ_ROUNDS of an IDCODE_PUB read and FREQ_BYPASS_SCANS
+ * pseudo-random BYPASS shifts at the current TCK, 0 if all came back right.
+ */
+static int freq_probe(u32 idcode, unsigned int delay)
+{
+	u32 seed = 0x2545F491, ir, id, tdi, tdo;
+	int round, i;
+
+	if (ast_jtag_set_tap_state(1, JTAG_STATE_IDLE) < 0)
+		return -1;
+
+	for (round = 0; round < JTAG_FREQ_ROUNDS; round++) {
+		//SIR 8 TDI (E0);
+		ir = IDCODE_PUB;
+		if (ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, &ir, &ir) < 0)
+			return -1;
+		//SDR 32 TDO (idcode);
+		id = 0;
+		if ((ast_jtag_tdo_xfer(0, 32, &id) < 0) || (id != idcode)) {
+			if (debug) printf("  IDCODE 0x%08X, expected 0x%08X\n", id, idcode);
+			return -1;
+		}
+
+		for (i = 0; i < FREQ_BYPASS_SCANS; i++) {
+			tdi = freq_prbs(&seed);
+			if (freq_bypass_scan(tdi, &tdo) < 0)
+				return -1;
+			if (!freq_bypass_ok(tdi, tdo, delay)) {
+				if (debug) printf("  BYPASS 0x%08X -> 0x%08X\n", tdi, tdo);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* freq_try: set freq and probe it, 0 if clean */
+static int freq_try(unsigned int freq, u32 idcode, unsigned int delay)
+{
+	int retval;
+
+	if (ast_set_jtag_freq(freq) < 0)
+		return -1;
+	retval = freq_probe(idcode, delay);
+	if (debug) printf("JTAG auto freq: %u Hz (%u Hz) %s\n", freq,
+			  ast_get_jtag_freq(), retval ? "errors" : "clean");
+
+	return retval;
+}
+
+/*************************************************************************************/
+/*				CACHE FILE					*/
+/* one line per board: <node> <IDCODE> <freq> */
+
+static unsigned int freq_cache_get(const char *node, u32 idcode)
+{
+	char line[512], name[256];
+	unsigned int id, freq, found = 0;
+	FILE *fp;
+
+	pthread_mutex_lock(&freq_cache_lock);
+	fp = fopen(JTAG_FREQ_CACHE, "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			if ((sscanf(line, "%255s %x %u", name, &id, &freq) == 3) &&
+			    !strcmp(name, node) && (id == idcode))
+				found = freq;
+		}
+		fclose(fp);
+	}
+	pthread_mutex_unlock(&freq_cache_lock);
+
+	return found;
+}
+
+static int freq_cache_put(const char *node, u32 idcode, unsigned int freq)
+{
+	char line[512], name[256], tmp[] = JTAG_FREQ_CACHE ".new";
+	unsigned int id, f;
+	FILE *in, *out;
+	int retval = 0;
+
+	pthread_mutex_lock(&freq_cache_lock);
+	if ((mkdir(CPLD_STATE_DIR, 0755) < 0) && (errno != EEXIST)) {
+		retval = -1;
+		goto out;
+	}
+
+	out = fopen(tmp, "w");
+	if (!out) {
+		retval = -1;
+		goto out;
+	}
+
+	//keep the other boards
+	in = fopen(JTAG_FREQ_CACHE, "r");
+	if (in) {
+		while (fgets(line, sizeof(line), in)) {
+			if ((sscanf(line, "%255s %x %u", name, &id, &f) == 3) &&
+			    (strcmp(name, node) || (id != idcode)))
+				fputs(line, out);
+		}
+		fclose(in);
+	}
+	fprintf(out, "%s 0x%08X %u\n", node, idcode, freq);
+
+	if (fclose(out) != 0)
+		retval = -1;
+	if ((retval == 0) && (rename(tmp, JTAG_FREQ_CACHE) != 0))
+		retval = -1;
+out:
+	if (retval < 0)
+		fprintf(stderr, "Cannot write '%s': %d, %s\n", JTAG_FREQ_CACHE, errno, strerror(errno));
+	pthread_mutex_unlock(&freq_cache_lock);
+
+	return retval;
+}
+
+/*************************************************************************************/
+/*
+ * jtag_auto_freq: leave the controller at the highest TCK up to max that
+ * probes clean, less JTAG_FREQ_MARGIN percent. The current TCK is the
+ * lower bound and must probe clean itself.
+ */
+int jtag_auto_freq(const char *node, u32 idcode, unsigned int max)
+{
+	unsigned int base, lo, hi, mid, freq;
+	int delay, step;
+
+	base = ast_get_jtag_freq();
+	delay = freq_bypass_delay();
+	if (!base || (delay < 0) || (freq_probe(idcode, delay) < 0)) {
+		printf("JTAG auto freq: errors at %u Hz already\n", base);
+		return -1;
+	}
+
+	//a cached TCK above this run's limit is clamped to it, the cache is kept
+	freq = freq_cache_get(node, idcode);
+	if (freq > max) {
+		printf("JTAG auto freq: cached %u Hz is above %u Hz, trying that\n", freq, max);
+		freq = max;
+	}
+	if (freq) {
+		if (freq_try(freq, idcode, delay) == 0) {
+			printf("JTAG auto freq: %u Hz, cached\n", ast_get_jtag_freq());
+			return 0;
+		}
+		printf("JTAG auto freq: cached %u Hz has errors, searching again\n", freq);
+	}
+
+	lo = base;
+	hi = max;
+	if ((hi > lo) && (freq_try(hi, idcode, delay) == 0)) {
+		lo = hi;
+	} else {
+		for (step = 0; (step < JTAG_FREQ_STEPS) && (hi > lo + lo / 16); step++) {
+			mid = lo + (hi - lo) / 2;
+			if (freq_try(mid, idcode, delay) == 0)
+				lo = mid;
+			else
+				hi = mid;
+		}
+	}
+
+	freq = (unsigned long long) lo * (100 - JTAG_FREQ_MARGIN) / 100;
+	if (freq < base)
+		freq = base;
+	if (freq_try(freq, idcode, delay) < 0) {
+		//margin or not, this board has no stable point above base
+		freq = base;
+		if (freq_try(freq, idcode, delay) < 0) {
+			printf("JTAG auto freq: errors back at %u Hz\n", base);
+			return -1;
+		}
+	}
+
+	printf("JTAG auto freq: %u Hz clean, using %u Hz\n", lo, ast_get_jtag_freq());
+	freq_cache_put(node, idcode, freq);
+
+	return 0;
+}
@@ -0,0 +1,296 @@
+/*
+JTAG over four GPIO lines (TCK, TMS, TDI, TDO) through libgpiod
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_LIBGPIOD
+#include <gpiod.h>
+#endif
+#include "ast-jtag.h"
+#include "jtag-backend.h"
+
+extern int debug;
+
+#define GPIO_CONSUMER		"ampere-cpld-fwupdate"
+#define GPIO_DEFAULT_FREQ	1000000
+
+enum { GPIO_TCK, GPIO_TMS, GPIO_TDI, GPIO_TDO, GPIO_LINES };
+
+/* TAP state after one TCK with TMS 0 / 1 */
+static const unsigned char tap_next[JTAG_STATE_CURRENT][2] = {
+	[JTAG_STATE_TLRESET]	= { JTAG_STATE_IDLE,		JTAG_STATE_TLRESET },
+	[JTAG_STATE_IDLE]	= { JTAG_STATE_IDLE,		JTAG_STATE_SELECTDR },
+	[JTAG_STATE_SELECTDR]	= { JTAG_STATE_CAPTUREDR,	JTAG_STATE_SELECTIR },
+	[JTAG_STATE_CAPTUREDR]	= { JTAG_STATE_SHIFTDR,		JTAG_STATE_EXIT1DR },
+	[JTAG_STATE_SHIFTDR]	= { JTAG_STATE_SHIFTDR,		JTAG_STATE_EXIT1DR },
+	[JTAG_STATE_EXIT1DR]	= { JTAG_STATE_PAUSEDR,		JTAG_STATE_UPDATEDR },
+	[JTAG_STATE_PAUSEDR]	= { JTAG_STATE_PAUSEDR,		JTAG_STATE_EXIT2DR },
+	[JTAG_STATE_EXIT2DR]	= { JTAG_STATE_SHIFTDR,		JTAG_STATE_UPDATEDR },
+	[JTAG_STATE_UPDATEDR]	= { JTAG_STATE_IDLE,		JTAG_STATE_SELECTDR },
+	[JTAG_STATE_SELECTIR]	= { JTAG_STATE_CAPTUREIR,	JTAG_STATE_TLRESET },
+	[JTAG_STATE_CAPTUREIR]	= { JTAG_STATE_SHIFTIR,		JTAG_STATE_EXIT1IR },
+	[JTAG_STATE_SHIFTIR]	= { JTAG_STATE_SHIFTIR,		JTAG_STATE_EXIT1IR },
+	[JTAG_STATE_EXIT1IR]	= { JTAG_STATE_PAUSEIR,		JTAG_STATE_UPDATEIR },
+	[JTAG_STATE_PAUSEIR]	= { JTAG_STATE_PAUSEIR,		JTAG_STATE_EXIT2IR },
+	[JTAG_STATE_EXIT2IR]	= { JTAG_STATE_SHIFTIR,		JTAG_STATE_UPDATEIR },
+	[JTAG_STATE_UPDATEIR]	= { JTAG_STATE_IDLE,		JTAG_STATE_SELECTDR },
+};
+
+static __thread unsigned char tap_state = JTAG_STATE_TLRESET;
+static __thread unsigned int gpio_freq = GPIO_DEFAULT_FREQ;
+
+/*************************************************************************************/
+/*				GPIO LINES					*/
+#ifdef HAVE_LIBGPIOD
+
+static __thread struct gpiod_chip *gpio_chip;
+static __thread struct gpiod_line *gpio_line[GPIO_LINES];
+
+/* spec: <chip>:<tck>,<tms>,<tdi>,<tdo> */
+static int gpio_lines_open(const char *spec)
+{
+	unsigned int offset[GPIO_LINES];
+	char chip[64];
+	int i, retval;
+
+	if (sscanf(spec, "%63[^:]:%u,%u,%u,%u", chip, &offset[GPIO_TCK], &offset[GPIO_TMS],
+		   &offset[GPIO_TDI], &offset[GPIO_TDO]) != 5) {
+		printf("GPIO JTAG needs gpio:<chip>:<tck>,<tms>,<tdi>,<tdo>\n");
+		return -1;
+	}
+
+	gpio_chip = gpiod_chip_open_lookup(chip);
+	if (!gpio_chip) {
+		fprintf(stderr, "Cannot open GPIO chip '%s': %d, %s\n", chip, errno, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < GPIO_LINES; i++) {
+		gpio_line[i] = gpiod_chip_get_line(gpio_chip, offset[i]);
+		if (!gpio_line[i]) {
+			retval = -1;
+		} else if (i == GPIO_TDO) {
+			retval = gpiod_line_request_input(gpio_line[i], GPIO_CONSUMER);
+		} else {
+			retval = gpiod_line_request_output(gpio_line[i], GPIO_CONSUMER, 0);
+		}
+		if (retval < 0) {
+			fprintf(stderr, "Cannot request GPIO line %u: %d, %s\n",
+				offset[i], errno, strerror(errno));
+			gpiod_chip_close(gpio_chip);
+			gpio_chip = NULL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void gpio_lines_close(void)
+{
+	if (gpio_chip)
+		gpiod_chip_close(gpio_chip);
+	gpio_chip = NULL;
+}
+
+static inline void gpio_set(int line, int value)
+{
+	JTAG_STATS_CALL(JTAG_CALL_GPIO);
+	gpiod_line_set_value(gpio_line[line], value);
+}
+
+static inline int gpio_get(int line)
+{
+	JTAG_STATS_CALL(JTAG_CALL_GPIO);
+	return gpiod_line_get_value(gpio_line[line]) > 0;
+}
+
+#else
+
+static int gpio_lines_open(const char *spec)
+{
+	(void) spec;
+	printf("GPIO JTAG is not available, built without libgpiod\n");
+	return -1;
+}
+
+static void gpio_lines_close(void)
+{
+}
+
+static inline void gpio_set(int line, int value)
+{
+	(void) line;
+	(void) value;
+}
+
+static inline int gpio_get(int line)
+{
+	(void) line;
+	return 0;
+}
+
+#endif
+
+/*************************************************************************************/
+/*				TAP BIT-BANG					*/
+
+/* one TCK: TMS/TDI are set up, TDO sampled before the rising edge */
+static int gpio_clock(int tms, int tdi)
+{
+	int tdo;
+
+	gpio_set(GPIO_TMS, tms);
+	gpio_set(GPIO_TDI, tdi);
+	tdo = gpio_get(GPIO_TDO);
+	gpio_set(GPIO_TCK, 1);
+	gpio_set(GPIO_TCK, 0);
+	tap_state = tap_next[tap_state][tms];
+
+	return tdo;
+}
+
+/* gpio_goto: shortest TMS path from the current state to state */
+static void gpio_goto(unsigned char state)
+{
+	unsigned char from[JTAG_STATE_CURRENT], tms[JTAG_STATE_CURRENT];
+	unsigned char queue[JTAG_STATE_CURRENT], path[JTAG_STATE_CURRENT];
+	int head = 0, tail = 0, n = 0, s, t, i;
+
+	if (tap_state == state)
+		return;
+
+	memset(from, 0xff, sizeof(from));
+	from[tap_state] = tap_state;
+	queue[tail++] = tap_state;
+	while (head < tail) {
+		s = queue[head++];
+		for (i = 0; i < 2; i++) {
+			t = tap_next[s][i];
+			if (from[t] != 0xff)
+				continue;
+			from[t] = s;
+			tms[t] = i;
+			queue[tail++] = t;
+		}
+	}
+
+	for (s = state; s != tap_state; s = from[s])
+		path[n++] = tms[s];
+	while (n--)
+		gpio_clock(path[n], 0);
+}
+
+static int gpio_open(const char *spec)
+{
+	if (gpio_lines_open(spec) < 0)
+		return -1;
+
+	//known state to start from
+	tap_state = JTAG_STATE_TLRESET;
+	gpio_clock(1, 0);
+	gpio_clock(1, 0);
+	gpio_clock(1, 0);
+	gpio_clock(1, 0);
+	gpio_clock(1, 0);
+	gpio_goto(JTAG_STATE_IDLE);
+
+	return 0;
+}
+
+static void gpio_close(void)
+{
+	gpio_lines_close();
+}
+
+static unsigned int gpio_get_freq(void)
+{
+	return gpio_freq;
+}
+
+/* TCK runs as fast as the lines toggle, the frequency is only recorded */
+static int gpio_set_freq(unsigned int freq)
+{
+	gpio_freq = freq;
+	return 0;
+}
+
+static int gpio_set_mode(unsigned int mode)
+{
+	(void) mode;
+	return 0;
+}
+
+/*
+ * gpio_xfer: go through Capture-IR/DR, shift len bits LSB first, leaving
+ * Shift on the last one, then stop in IDLE or PAUSE.
+ */
+static int gpio_xfer(unsigned char type, unsigned char direct,
+		     unsigned char end, unsigned int len, u32 *tdio)
+{
+	unsigned int i;
+	int tdi, tdo;
+
+	if (type == JTAG_SIR_XFER) {
+		gpio_goto(JTAG_STATE_CAPTUREIR);
+	} else {
+		gpio_goto(JTAG_STATE_CAPTUREDR);
+	}
+	gpio_clock(0, 0);
+
+	for (i = 0; i < len; i++) {
+		tdi = (direct & JTAG_WRITE_XFER) ? (tdio[i / 32] >> (i % 32)) & 1 : 0;
+		tdo = gpio_clock(i == len - 1, tdi);
+		if (direct & JTAG_READ_XFER) {
+			if (tdo)
+				tdio[i / 32] |= 1u << (i % 32);
+			else
+				tdio[i / 32] &= ~(1u << (i % 32));
+		}
+	}
+
+	if (end)
+		gpio_goto(type == JTAG_SIR_XFER ? JTAG_STATE_PAUSEIR : JTAG_STATE_PAUSEDR);
+	else
+		gpio_goto(JTAG_STATE_IDLE);
+
+	return 0;
+}
+
+static int gpio_runtest(unsigned int tcks)
+{
+	gpio_goto(JTAG_STATE_IDLE);
+	while (tcks--)
+		gpio_clock(0, 0);
+
+	return 0;
+}
+
+static int gpio_set_state(unsigned char reset, unsigned char endstate)
+{
+	int i;
+
+	if (reset) {
+		for (i = 0; i < 5; i++)
+			gpio_clock(1, 0);
+	}
+	if (endstate < JTAG_STATE_CURRENT)
+		gpio_goto(endstate);
+
+	return 0;
+}
+
+const struct jtag_backend jtag_gpio_backend = {
+	.name = "gpio",
+	.open = gpio_open,
+	.close = gpio_close,
+	.get_freq = gpio_get_freq,
+	.set_freq = gpio_set_freq,
+	.set_mode = gpio_set_mode,
+	.xfer = gpio_xfer,
+	.runtest = gpio_runtest,
+	.set_state = gpio_set_state,
+};
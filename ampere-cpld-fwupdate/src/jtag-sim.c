@@ -0,0 +1,619 @@
+/*
+MachXO2 TAP and flash simulator
+
+Models the instructions lattice.c uses at SIR/SDR level: IDCODE, USERCODE,
+erase, row program with busy timing, readback, DONE, refresh and status. A
+row read needs its run-test clocks, so a backend that drops them fails. With
+"sim:<file>" the flash is loaded from and saved to <file>, so a program run
+can be verified by a later one. "sim<n>[:<file>]" chains n devices, device 0
+next to TDO, device i > 0 keeping its flash in <file>.<i>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "lattice.h"
+#include "ast-jtag.h"
+#include "jtag-backend.h"
+
+extern int debug;
+
+#define SIM_IDCODE		0x012BC043	/* LCMXO2-4000HC */
+#define SIM_DR_BITS		128
+#define SIM_DR_WORDS		(SIM_DR_BITS / 32)
+#define SIM_CFG_ROWS		9212
+#define SIM_UFM_ROWS		2048
+#define SIM_FREQ		10000000
+#define SIM_FREQ_LIMIT		30000000	/* TDO sampled wrong above */
+#define SIM_CHAIN_MAX		JTAG_CHAIN_MAX
+
+/* busy times */
+#define SIM_ROW_PROG_US		200
+#define SIM_ERASE_US		350000
+#define SIM_DONE_US		200
+#define SIM_REFRESH_US		50000
+
+/* Run-Test/Idle TCKs that fetch the next row for LSC_READ_INCR_NV */
+#define SIM_READ_TCKS		2
+
+/* ISC_ERASE operand */
+#define SIM_ERASE_CFG		0x04
+#define SIM_ERASE_UFM		0x08
+
+/* LSC_READ_STATUS bits */
+#define SIM_STATUS_DONE		(1 << 8)
+#define SIM_STATUS_ENABLE	(1 << 9)
+#define SIM_STATUS_BUSY		(1 << 12)
+#define SIM_STATUS_FAIL		(1 << 13)
+
+#define SIM_FILE_MAGIC		0x4D49534D	/* "MSIM" */
+
+/**
+ * struct sim_file_header - flash file header:
+ *
+ * @magic: SIM_FILE_MAGIC
+ * @cfg_rows: CFG rows following the header
+ * @ufm_rows: UFM rows following the CFG rows
+ * @dr_bits: bits per row
+ * @usercode: programmed USERCODE
+ * @done: DONE bit
+ */
+struct sim_file_header {
+	u32	magic;
+	u32	cfg_rows;
+	u32	ufm_rows;
+	u32	dr_bits;
+	u32	usercode;
+	u32	done;
+};
+
+/**
+ * struct sim_dev - simulated device:
+ *
+ * @path: flash file, empty for a volatile flash
+ * @cfg: CFG flash rows
+ * @ufm: UFM flash rows
+ * @usercode: programmed USERCODE
+ * @usercode_reg: USERCODE data register, programmed by ISC_PROGRAM_USERCODE
+ * @done: DONE bit
+ * @enabled: in ISC_ENABLE/ISC_ENABLE_X mode
+ * @fail: a command failed since the last erase
+ * @ir: current instruction
+ * @ufm_sel: address points to the UFM
+ * @addr: current row
+ * @busy_until: CLOCK_MONOTONIC time in us the flash is busy until
+ * @freq: TCK frequency
+ * @idle_tcks: Run-Test/Idle TCKs since the last SIR or row read
+ * @runtest_tcks: Run-Test/Idle TCKs in total
+ * @rows_programmed, @rows_read, @erases, @busy_polls, @busy_errors: counters
+ * @tck_errors: rows read before their run-test clocks
+ */
+struct sim_dev {
+	char		path[256];
+	u32		cfg[SIM_CFG_ROWS][SIM_DR_WORDS];
+	u32		ufm[SIM_UFM_ROWS][SIM_DR_WORDS];
+	u32		usercode;
+	u32		usercode_reg;
+	int		done;
+	int		enabled;
+	int		fail;
+	u8		ir;
+	int		ufm_sel;
+	unsigned int	addr;
+	unsigned long long	busy_until;
+	unsigned int	freq;
+	unsigned int	idle_tcks;
+	unsigned long long	runtest_tcks;
+	unsigned int	rows_programmed;
+	unsigned int	rows_read;
+	unsigned int	erases;
+	unsigned int	busy_polls;
+	unsigned int	busy_errors;
+	unsigned int	tck_errors;
+};
+
+/* device being run, one of sim_chain[] */
+static __thread struct sim_dev *sim;
+
+static __thread struct sim_dev *sim_chain[SIM_CHAIN_MAX];
+static __thread int sim_devs;
+
+/*************************************************************************************/
+
+static unsigned long long sim_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int sim_busy(void)
+{
+	return sim_time_us() < sim->busy_until;
+}
+
+/* a flash command while busy fails the device, as the real one would */
+static int sim_check_busy(void)
+{
+	if (!sim_busy())
+		return 0;
+
+	sim->busy_errors++;
+	sim->fail = 1;
+	if (debug) printf("sim: command 0x%02X while busy\n", sim->ir);
+
+	return -1;
+}
+
+static u32 *sim_row(void)
+{
+	if (sim->ufm_sel)
+		return (sim->addr < SIM_UFM_ROWS) ? sim->ufm[sim->addr] : NULL;
+
+	return (sim->addr < SIM_CFG_ROWS) ? sim->cfg[sim->addr] : NULL;
+}
+
+static int sim_load(void)
+{
+	struct sim_file_header hdr;
+	FILE *fp;
+	int retval = 0;
+
+	fp = fopen(sim->path, "rb");
+	if (!fp) {
+		//no file yet, start from an erased device
+		return (errno == ENOENT) ? 0 : -1;
+	}
+
+	if ((fread(&hdr, sizeof(hdr), 1, fp) != 1) || (hdr.magic != SIM_FILE_MAGIC) ||
+	    (hdr.cfg_rows != SIM_CFG_ROWS) || (hdr.ufm_rows != SIM_UFM_ROWS) ||
+	    (hdr.dr_bits != SIM_DR_BITS) ||
+	    (fread(sim->cfg, sizeof(sim->cfg), 1, fp) != 1) ||
+	    (fread(sim->ufm, sizeof(sim->ufm), 1, fp) != 1)) {
+		printf("sim: '%s' is not a simulator flash file\n", sim->path);
+		retval = -1;
+	} else {
+		sim->usercode = hdr.usercode;
+		sim->done = hdr.done;
+	}
+	fclose(fp);
+
+	return retval;
+}
+
+static int sim_save(void)
+{
+	struct sim_file_header hdr;
+	char tmp[sizeof(sim->path) + 4];
+	FILE *fp;
+	int retval = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.new", sim->path);
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n", tmp, errno, strerror(errno));
+		return -1;
+	}
+
+	hdr.magic = SIM_FILE_MAGIC;
+	hdr.cfg_rows = SIM_CFG_ROWS;
+	hdr.ufm_rows = SIM_UFM_ROWS;
+	hdr.dr_bits = SIM_DR_BITS;
+	hdr.usercode = sim->usercode;
+	hdr.done = sim->done;
+	if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+	    (fwrite(sim->cfg, sizeof(sim->cfg), 1, fp) != 1) ||
+	    (fwrite(sim->ufm, sizeof(sim->ufm), 1, fp) != 1))
+		retval = -1;
+	if (fclose(fp) != 0)
+		retval = -1;
+	if ((retval == 0) && (rename(tmp, sim->path) != 0))
+		retval = -1;
+	if (retval < 0)
+		fprintf(stderr, "Cannot write '%s': %d, %s\n", sim->path, errno, strerror(errno));
+
+	return retval;
+}
+
+static void sim_close(void)
+{
+	int i;
+
+	for (i = 0; i < sim_devs; i++) {
+		sim = sim_chain[i];
+		if (sim_devs > 1)
+			printf("sim%d: ", i);
+		else
+			printf("sim: ");
+		printf("%u rows programmed, %u rows read, %u erases, %u busy polls, %u busy errors, "
+		       "%llu run-test TCKs, %u TCK errors%s\n",
+		       sim->rows_programmed, sim->rows_read, sim->erases, sim->busy_polls,
+		       sim->busy_errors, sim->runtest_tcks, sim->tck_errors,
+		       sim->fail ? ", FAIL set" : "");
+
+		if (sim->path[0])
+			sim_save();
+		free(sim);
+		sim_chain[i] = NULL;
+	}
+	sim = NULL;
+	sim_devs = 0;
+}
+
+/* arg: [<n>][:<file>] */
+static int sim_open(const char *arg)
+{
+	char *end;
+	int i, n = 1;
+
+	if ((*arg >= '0') && (*arg <= '9')) {
+		n = strtol(arg, &end, 10);
+		arg = end;
+	}
+	if ((n < 1) || (n > SIM_CHAIN_MAX) || (*arg && (*arg != ':'))) {
+		printf("Simulator needs sim[<n>][:<file>], n up to %d\n", SIM_CHAIN_MAX);
+		return -1;
+	}
+	if (*arg)
+		arg++;
+
+	for (i = 0; i < n; i++) {
+		sim = calloc(1, sizeof(*sim));
+		if (!sim) {
+			printf("Out of memory for the simulator\n");
+			sim_close();
+			return -1;
+		}
+		sim_chain[sim_devs++] = sim;
+		if (*arg && i)
+			snprintf(sim->path, sizeof(sim->path), "%s.%d", arg, i);
+		else
+			snprintf(sim->path, sizeof(sim->path), "%s", arg);
+		sim->freq = SIM_FREQ;
+		sim->ir = IDCODE_PUB;
+
+		if (sim->path[0] && (sim_load() < 0)) {
+			//leave the files as they are
+			for (i = 0; i < sim_devs; i++)
+				sim_chain[i]->path[0] = 0;
+			sim_close();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static unsigned int sim_get_freq(void)
+{
+	return sim_chain[0]->freq;
+}
+
+static int sim_set_freq(unsigned int freq)
+{
+	int i;
+
+	for (i = 0; i < sim_devs; i++)
+		sim_chain[i]->freq = freq;
+	return 0;
+}
+
+static int sim_set_mode(unsigned int mode)
+{
+	(void) mode;
+	return 0;
+}
+
+/* instructions that act on Update-IR */
+static void sim_sir(u8 ir)
+{
+	sim->ir = ir;
+	sim->idle_tcks = 0;
+
+	switch (ir) {
+	case LSC_INIT_ADDR_UFM:
+		sim->ufm_sel = 1;
+		sim->addr = 0;
+		break;
+	case ISC_PROGRAM_USERCODE:
+		if (sim_check_busy() == 0) {
+			sim->usercode = sim->usercode_reg;
+			sim->busy_until = sim_time_us() + SIM_DONE_US;
+		}
+		break;
+	case ISC_PROGRAM_DONE:
+		if (sim_check_busy() == 0) {
+			sim->done = 1;
+			sim->busy_until = sim_time_us() + SIM_DONE_US;
+		}
+		break;
+	case ISC_DISABLE:
+		sim->enabled = 0;
+		break;
+	case LSC_REFRESH:
+		if (sim_check_busy() == 0) {
+			sim->enabled = 0;
+			sim->busy_until = sim_time_us() + SIM_REFRESH_US;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void sim_erase(u32 op)
+{
+	if (sim_check_busy() < 0)
+		return;
+
+	if (op & SIM_ERASE_CFG) {
+		memset(sim->cfg, 0, sizeof(sim->cfg));
+		sim->usercode = 0;
+		sim->done = 0;
+	}
+	if (op & SIM_ERASE_UFM)
+		memset(sim->ufm, 0, sizeof(sim->ufm));
+	sim->fail = 0;
+	sim->erases++;
+	sim->busy_until = sim_time_us() + SIM_ERASE_US;
+}
+
+/*
+ * sim_sdr: run the data register of the current instruction. in is the
+ * shifted in data, out gets the captured data.
+ */
+static void sim_sdr(unsigned int len, const u32 *in, u32 *out)
+{
+	u32 *row;
+	int i;
+
+	memset(out, 0, ((len + 31) / 32) * sizeof(u32));
+
+	switch (sim->ir) {
+	case IDCODE:
+	case IDCODE_PUB:
+		out[0] = SIM_IDCODE;
+		break;
+	case USERCODE:
+		out[0] = sim->usercode;
+		sim->usercode_reg = in[0];
+		break;
+	case ISC_ENABLE:
+	case ISC_ENABLE_X:
+		sim->enabled = 1;
+		break;
+	case ISC_ERASE:
+		sim_erase(in[0]);
+		break;
+	case LSC_CHECK_BUSY:
+		sim->busy_polls++;
+		out[0] = sim_busy();
+		break;
+	case LSC_READ_STATUS:
+		out[0] = (sim->done ? SIM_STATUS_DONE : 0) |
+			 (sim->enabled ? SIM_STATUS_ENABLE : 0) |
+			 (sim_busy() ? SIM_STATUS_BUSY : 0) |
+			 (sim->fail ? SIM_STATUS_FAIL : 0);
+		break;
+	case LSC_INIT_ADDRESS:
+		sim->ufm_sel = 0;
+		sim->addr = 0;
+		break;
+	case LSC_WRITE_ADDRESS:
+		sim->ufm_sel = (in[0] >> 30) & 1;
+		sim->addr = in[0] & LATTICE_PAGE_MASK;
+		break;
+	case LSC_PROG_INCR_NV:
+		row = sim_row();
+		if (!row || (len != SIM_DR_BITS) || (sim_check_busy() < 0)) {
+			sim->fail = 1;
+			break;
+		}
+		//flash bits only go from erased to programmed
+		for (i = 0; i < SIM_DR_WORDS; i++) {
+			if (row[i])
+				sim->fail = 1;
+			row[i] |= in[i];
+		}
+		sim->addr++;
+		sim->rows_programmed++;
+		sim->busy_until = sim_time_us() + SIM_ROW_PROG_US;
+		break;
+	case LSC_READ_INCR_NV:
+		//the row was not fetched without its run-test clocks
+		if (sim->idle_tcks < SIM_READ_TCKS) {
+			sim->tck_errors++;
+			sim->fail = 1;
+			if (debug) printf("sim: row %u read after %u run-test TCKs\n",
+					  sim->addr, sim->idle_tcks);
+			sim->idle_tcks = 0;
+			break;
+		}
+		sim->idle_tcks = 0;
+		row = sim_row();
+		if (!row || (len != SIM_DR_BITS) || (sim_check_busy() < 0)) {
+			sim->fail = 1;
+			break;
+		}
+		memcpy(out, row, SIM_DR_WORDS * sizeof(u32));
+		sim->addr++;
+		sim->rows_read++;
+		break;
+	default:
+		//BYPASS and the rest: one bit register
+		out[0] = 0;
+		break;
+	}
+}
+
+/* sim_dr_bits: data register length of the current instruction, 0 - any */
+static unsigned int sim_dr_bits(void)
+{
+	switch (sim->ir) {
+	case BYPASS:
+		return 1;
+	case IDCODE:
+	case IDCODE_PUB:
+	case USERCODE:
+		return 32;
+	case LSC_PROG_INCR_NV:
+	case LSC_READ_INCR_NV:
+		return SIM_DR_BITS;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * sim_chain_xfer: split a scan between the devices, device 0 takes the
+ * first bits. On IR every device takes 8 bits; on DR a device takes the
+ * length of its data register and the one device with a free length the
+ * rest. Bits beyond the registers are the first TDI bits, as on a real
+ * chain.
+ */
+static void sim_chain_xfer(unsigned char type, unsigned int len, const u32 *in, u32 *out)
+{
+	unsigned int bits[SIM_CHAIN_MAX], pos = 0, fixed = 0;
+	u32 din[SIM_DR_WORDS * 4], dout[SIM_DR_WORDS * 4];
+	u32 *pin, *pout;
+	int i, any = -1;
+
+	for (i = 0; i < sim_devs; i++) {
+		sim = sim_chain[i];
+		bits[i] = (type == JTAG_SIR_XFER) ? LATTICE_INS_LENGTH : sim_dr_bits();
+		if (!bits[i] && (any < 0))
+			any = i;
+		else if (!bits[i])
+			bits[i] = 32;
+		fixed += bits[i];
+	}
+	if (any >= 0)
+		bits[any] = (len > fixed) ? len - fixed : 0;
+
+	for (i = 0; (i < sim_devs) && (pos < len); i++) {
+		unsigned int n = (bits[i] < len - pos) ? bits[i] : len - pos;
+		unsigned int words = (n + 31) / 32;
+
+		sim = sim_chain[i];
+		pin = din;
+		pout = dout;
+		if (words > SIM_DR_WORDS * 4) {
+			pin = calloc(words, sizeof(u32));
+			pout = calloc(words, sizeof(u32));
+			if (!pin || !pout) {
+				free(pin);
+				free(pout);
+				sim->fail = 1;
+				pos += n;
+				continue;
+			}
+		}
+		memset(pin, 0, words * sizeof(u32));
+		jtag_bits_copy(pin, 0, in, pos, n);
+
+		if (type == JTAG_SIR_XFER) {
+			//IR capture: 01 in the low bits, DONE in bit 2
+			pout[0] = 0x01 | (sim->done ? 0x04 : 0);
+			sim_sir(pin[0] & 0xff);
+		} else {
+			sim_sdr(n, pin, pout);
+		}
+		jtag_bits_copy(out, pos, pout, 0, n);
+		pos += n;
+
+		if (pin != din) {
+			free(pin);
+			free(pout);
+		}
+	}
+
+	if (pos < len)
+		jtag_bits_copy(out, pos, in, 0, len - pos);
+}
+
+static int sim_xfer(unsigned char type, unsigned char direct,
+		    unsigned char end, unsigned int len, u32 *tdio)
+{
+	unsigned int words = (len + 31) / 32;
+	u32 in[SIM_DR_WORDS * 4], out[SIM_DR_WORDS * 4];
+	u32 *pin = in, *pout = out;
+	unsigned int bit;
+
+	(void) end;
+	JTAG_STATS_CALL(JTAG_CALL_XFER_BUF);
+
+	if (words > SIM_DR_WORDS * 4) {
+		pin = calloc(words, sizeof(u32));
+		pout = calloc(words, sizeof(u32));
+		if (!pin || !pout) {
+			free(pin);
+			free(pout);
+			return -1;
+		}
+	}
+
+	if (direct & JTAG_WRITE_XFER)
+		memcpy(pin, tdio, words * sizeof(u32));
+	else
+		memset(pin, 0, words * sizeof(u32));
+	if (len % 32)
+		pin[words - 1] &= (1u << (len % 32)) - 1;
+
+	memset(pout, 0, words * sizeof(u32));
+	sim_chain_xfer(type, len, pin, pout);
+
+	//a board past its TCK limit: one TDO bit per scan goes wrong
+	if ((sim_chain[0]->freq > SIM_FREQ_LIMIT) && len) {
+		bit = jtag_stats.calls % len;
+		pout[bit / 32] ^= 1u << (bit % 32);
+	}
+
+	if (direct & JTAG_READ_XFER)
+		memcpy(tdio, pout, words * sizeof(u32));
+
+	if (pin != in) {
+		free(pin);
+		free(pout);
+	}
+
+	return 0;
+}
+
+static int sim_runtest(unsigned int tcks)
+{
+	int i;
+
+	JTAG_STATS_CALL(JTAG_CALL_STATE);
+	for (i = 0; i < sim_devs; i++) {
+		sim_chain[i]->idle_tcks += tcks;
+		sim_chain[i]->runtest_tcks += tcks;
+	}
+	return 0;
+}
+
+static int sim_set_state(unsigned char reset, unsigned char endstate)
+{
+	int i;
+
+	(void) endstate;
+	JTAG_STATS_CALL(JTAG_CALL_STATE);
+	for (i = 0; reset && (i < sim_devs); i++)
+		sim_chain[i]->ir = IDCODE_PUB;
+	return 0;
+}
+
+const struct jtag_backend jtag_sim_backend = {
+	.name = "sim",
+	.open = sim_open,
+	.close = sim_close,
+	.get_freq = sim_get_freq,
+	.set_freq = sim_set_freq,
+	.set_mode = sim_set_mode,
+	.xfer = sim_xfer,
+	.runtest = sim_runtest,
+	.set_state = sim_set_state,
+};
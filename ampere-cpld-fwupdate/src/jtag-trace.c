@@ -0,0 +1,387 @@
+/*
+JTAG operation trace: --record and --replay
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "ast-jtag.h"
+#include "jtag-backend.h"
+#include "jtag-trace.h"
+
+extern int debug;
+extern unsigned int freq;
+
+/* recording of the calling thread, NULL when not recording */
+__thread struct jtag_trace *jtag_trace;
+
+static const char *jtag_trace_names[JTAG_TRACE_OPS] = {
+	[JTAG_TRACE_SIR] = "sir",
+	[JTAG_TRACE_SDR] = "sdr",
+	[JTAG_TRACE_RUNTEST] = "runtest",
+	[JTAG_TRACE_WAIT] = "wait",
+	[JTAG_TRACE_STATE] = "state",
+	[JTAG_TRACE_FREQ] = "freq",
+};
+
+static unsigned long long jtag_trace_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int jtag_trace_words(const struct jtag_trace_rec *rec)
+{
+	if ((rec->op != JTAG_TRACE_SIR) && (rec->op != JTAG_TRACE_SDR))
+		return 0;
+
+	return (rec->len + 31) / 32;
+}
+
+static void jtag_trace_write(struct jtag_trace *t, const void *buf, size_t len)
+{
+	if (t->error)
+		return;
+
+	if (fwrite(buf, 1, len, t->fp) != len) {
+		printf("Trace Error - cannot write '%s'\n", t->path);
+		t->error = 1;
+		return;
+	}
+	t->bytes += len;
+}
+
+/*************************************************************************************/
+
+/*
+ * jtag_trace_open: record the operations of the calling thread to path,
+ * the controller is open and runs at freq.
+ */
+int jtag_trace_open(const char *path, const char *node, unsigned int freq)
+{
+	struct jtag_trace_header hdr;
+	struct jtag_trace *t;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return -1;
+	t->tdi = malloc(JTAG_TRACE_WORDS * sizeof(u32));
+	if (!t->tdi) {
+		free(t);
+		return -1;
+	}
+
+	t->fp = fopen(path, "w");
+	if (!t->fp) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+		free(t->tdi);
+		free(t);
+		return -1;
+	}
+	//records are small, let stdio batch them
+	setvbuf(t->fp, NULL, _IOFBF, 1 << 16);
+	t->path = path;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = JTAG_TRACE_MAGIC;
+	hdr.version = JTAG_TRACE_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.freq = freq;
+	strncpy(hdr.node, node, sizeof(hdr.node) - 1);
+	jtag_trace_write(t, &hdr, sizeof(hdr));
+
+	t->last = jtag_trace_time_us();
+	jtag_trace = t;
+
+	return t->error ? -1 : 0;
+}
+
+void jtag_trace_close(void)
+{
+	struct jtag_trace *t = jtag_trace;
+
+	if (!t)
+		return;
+	jtag_trace = NULL;
+
+	if (fclose(t->fp) && !t->error) {
+		printf("Trace Error - cannot write '%s'\n", t->path);
+		t->error = 1;
+	}
+	printf("Trace: %llu operations, %llu bytes to %s%s\n", t->records, t->bytes,
+	       t->path, t->error ? ", incomplete" : "");
+
+	free(t->tdi);
+	free(t);
+}
+
+/*
+ * jtag_trace_begin: an operation starts, tdi is kept until jtag_trace_end()
+ * as the operation may shift TDO into the same words.
+ */
+void jtag_trace_begin(u8 op, u8 direct, u8 end, unsigned int len, const u32 *tdi)
+{
+	struct jtag_trace *t = jtag_trace;
+	unsigned int words;
+
+	memset(&t->rec, 0, sizeof(t->rec));
+	t->rec.op = op;
+	t->rec.direct = direct;
+	t->rec.end = end;
+	t->rec.len = len;
+
+	words = jtag_trace_words(&t->rec);
+	if (words > JTAG_TRACE_WORDS) {
+		printf("Trace Error - %u bit scan, at most %u\n", len, JTAG_TRACE_WORDS * 32);
+		t->error = 1;
+	} else if ((direct & JTAG_WRITE_XFER) && words) {
+		memcpy(t->tdi, tdi, words * sizeof(u32));
+	}
+
+	t->start = jtag_trace_time_us();
+}
+
+/* jtag_trace_end: the operation is done, write its record */
+void jtag_trace_end(int retval, const u32 *tdo)
+{
+	struct jtag_trace *t = jtag_trace;
+	unsigned long long now = jtag_trace_time_us();
+	unsigned int words = jtag_trace_words(&t->rec);
+
+	t->rec.status = (retval < 0);
+	t->rec.gap_us = t->start - t->last;
+	t->rec.us = now - t->start;
+	t->last = now;
+
+	jtag_trace_write(t, &t->rec, sizeof(t->rec));
+	if (words && (t->rec.direct & JTAG_WRITE_XFER))
+		jtag_trace_write(t, t->tdi, words * sizeof(u32));
+	if (words && (t->rec.direct & JTAG_READ_XFER))
+		jtag_trace_write(t, tdo, words * sizeof(u32));
+	t->records++;
+}
+
+/*************************************************************************************/
+
+/**
+ * struct jtag_replay - replay totals:
+ *
+ * @ops: records by JTAG_TRACE_*
+ * @bits: SIR/SDR bits
+ * @tcks: RUNTEST TCKs
+ * @op_us: recorded time of the operations
+ * @wait_us: recorded time of the waits
+ * @gap_us: recorded time spent in the tool between operations
+ * @failed: operations that failed in the replay
+ * @retries: polls repeated to reach the recorded TDO
+ * @mismatches: reads with other TDO than recorded
+ * @bad: first mismatching records
+ */
+struct jtag_replay {
+	unsigned long long	ops[JTAG_TRACE_OPS];
+	unsigned long long	bits;
+	unsigned long long	tcks;
+	unsigned long long	op_us;
+	unsigned long long	wait_us;
+	unsigned long long	gap_us;
+	unsigned long long	failed;
+	unsigned long long	retries;
+	unsigned long long	mismatches;
+	unsigned long long	bad[JTAG_TRACE_REPORT];
+};
+
+static void jtag_replay_report(const struct jtag_replay *r, unsigned long long records,
+			       unsigned long long us)
+{
+	unsigned long long rec_us = r->op_us + r->wait_us + r->gap_us;
+	unsigned long long jtag_us = us ? us : 1;
+	unsigned int i;
+
+	printf("Replay: %llu operations,", records);
+	for (i = 0; i < JTAG_TRACE_OPS; i++) {
+		if (r->ops[i])
+			printf(" %s %llu", jtag_trace_names[i], r->ops[i]);
+	}
+	printf(", %llu bits, %llu tck\n", r->bits, r->tcks);
+	printf("  recorded: %llu.%03llu s, %llu.%03llu s JTAG, %llu.%03llu s waits, "
+	       "%llu.%03llu s in the tool\n",
+	       rec_us / 1000000, rec_us / 1000 % 1000,
+	       r->op_us / 1000000, r->op_us / 1000 % 1000,
+	       r->wait_us / 1000000, r->wait_us / 1000 % 1000,
+	       r->gap_us / 1000000, r->gap_us / 1000 % 1000);
+	printf("  replayed: %llu.%03llu s, %llu ops/s, %llu kbit/s, %llu driver calls\n",
+	       us / 1000000, us / 1000 % 1000,
+	       records * 1000000 / jtag_us, r->bits * 1000 / jtag_us, jtag_stats.calls);
+
+	if (r->failed)
+		printf("  %llu operations failed\n", r->failed);
+	if (r->retries)
+		printf("  %llu polls repeated, the device was busy longer than recorded\n", r->retries);
+	if (r->mismatches) {
+		printf("  TDO differs from the recording in %llu reads, records", r->mismatches);
+		for (i = 0; (i < JTAG_TRACE_REPORT) && (i < r->mismatches); i++)
+			printf(" %llu", r->bad[i]);
+		printf("%s\n", r->mismatches > JTAG_TRACE_REPORT ? " ..." : "");
+	}
+}
+
+/* jtag_replay_xfer: replay a SIR/SDR into buf, 1 when TDO is as recorded */
+static int jtag_replay_xfer(const struct jtag_trace_rec *rec, const u32 *tdi,
+			    const u32 *tdo, u32 *buf)
+{
+	unsigned int words = jtag_trace_words(rec);
+
+	if (rec->direct & JTAG_WRITE_XFER)
+		memcpy(buf, tdi, words * sizeof(u32));
+	else
+		memset(buf, 0, words * sizeof(u32));
+	if (ast_jtag_xfer(rec->op, rec->direct, rec->end, rec->len, buf) < 0)
+		return -1;
+
+	if (!(rec->direct & JTAG_READ_XFER) || rec->status)
+		return 1;
+	//bits past len are not shifted
+	if (rec->len % 32)
+		buf[words - 1] ^= (buf[words - 1] ^ tdo[words - 1]) &
+				  ~((1u << (rec->len % 32)) - 1);
+
+	return !memcmp(buf, tdo, words * sizeof(u32));
+}
+
+/* jtag_replay_ready: a short read recorded as all zeros, a poll that saw ready */
+static int jtag_replay_ready(const struct jtag_trace_rec *rec, const u32 *tdo)
+{
+	if (!(rec->direct & JTAG_READ_XFER) || (rec->len > 32))
+		return 0;
+
+	return !(tdo[0] & (rec->len < 32 ? (1u << rec->len) - 1 : ~0u));
+}
+
+/*
+ * jtag_trace_replay: play the trace at path through the open controller,
+ * recorded waits included, time spent in the tool left out. Without that
+ * time a device can still be busy where the recording saw it ready: a
+ * short read recorded as all zeros, a busy poll seeing ready, is repeated
+ * after the wait and the tool time before it until it reads as recorded.
+ * Other TDO that differs is reported.
+ * Returns -1 when the trace is bad or an operation failed.
+ */
+int jtag_trace_replay(const char *path)
+{
+	struct jtag_trace_header hdr;
+	struct jtag_trace_rec rec;
+	struct jtag_replay r;
+	unsigned long long records = 0, start;
+	u32 *tdi, *tdo, *buf;
+	unsigned int words, wait_us = 0, retry_us, retry;
+	FILE *fp;
+	int retval = 0, match;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+		return -1;
+	}
+
+	if ((fread(&hdr, sizeof(hdr), 1, fp) != 1) || (hdr.magic != JTAG_TRACE_MAGIC) ||
+	    (hdr.version != JTAG_TRACE_VERSION) || (hdr.header_size < sizeof(hdr)) ||
+	    fseek(fp, hdr.header_size, SEEK_SET)) {
+		printf("Trace Error - '%s' is not a JTAG trace\n", path);
+		fclose(fp);
+		return -1;
+	}
+	hdr.node[sizeof(hdr.node) - 1] = 0;
+	printf("Replay %s, recorded on %s at %u Hz\n", path, hdr.node, hdr.freq);
+
+	tdi = malloc(JTAG_TRACE_WORDS * sizeof(u32));
+	tdo = malloc(JTAG_TRACE_WORDS * sizeof(u32));
+	buf = malloc(JTAG_TRACE_WORDS * sizeof(u32));
+	if (!tdi || !tdo || !buf) {
+		retval = -1;
+		goto out;
+	}
+
+	//-f wins over the recorded frequency
+	if (!freq && hdr.freq)
+		ast_set_jtag_freq(hdr.freq);
+
+	memset(&r, 0, sizeof(r));
+	start = jtag_trace_time_us();
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		words = jtag_trace_words(&rec);
+		if ((rec.op >= JTAG_TRACE_OPS) || (words > JTAG_TRACE_WORDS) ||
+		    ((rec.direct & JTAG_WRITE_XFER) && words &&
+		     (fread(tdi, sizeof(u32), words, fp) != words)) ||
+		    ((rec.direct & JTAG_READ_XFER) && words &&
+		     (fread(tdo, sizeof(u32), words, fp) != words))) {
+			printf("Trace Error - bad record %llu\n", records);
+			retval = -1;
+			break;
+		}
+		records++;
+		r.ops[rec.op]++;
+		r.gap_us += rec.gap_us;
+		if (rec.op == JTAG_TRACE_WAIT)
+			r.wait_us += rec.us;
+		else
+			r.op_us += rec.us;
+
+		switch (rec.op) {
+		case JTAG_TRACE_SIR:
+		case JTAG_TRACE_SDR:
+			r.bits += rec.len;
+			match = jtag_replay_xfer(&rec, tdi, tdo, buf);
+			//the tool waited the gap or a recorded wait before the poll
+			retry_us = wait_us + rec.gap_us;
+			if (retry_us < JTAG_TRACE_RETRY_US)
+				retry_us = JTAG_TRACE_RETRY_US;
+			for (retry = 0; (match == 0) && jtag_replay_ready(&rec, tdo) &&
+			     (retry < JTAG_TRACE_RETRY_MAX_US / retry_us); retry++) {
+				usleep(retry_us);
+				r.retries++;
+				match = jtag_replay_xfer(&rec, tdi, tdo, buf);
+			}
+			if (match < 0) {
+				r.failed++;
+			} else if (match == 0) {
+				if (r.mismatches < JTAG_TRACE_REPORT)
+					r.bad[r.mismatches] = records - 1;
+				r.mismatches++;
+			}
+			break;
+		case JTAG_TRACE_RUNTEST:
+			r.tcks += rec.len;
+			jtag_runtest_idle(rec.len, 0);
+			break;
+		case JTAG_TRACE_WAIT:
+			usleep(rec.len);
+			break;
+		case JTAG_TRACE_STATE:
+			if (ast_jtag_set_tap_state(rec.direct, rec.end) < 0)
+				r.failed++;
+			break;
+		case JTAG_TRACE_FREQ:
+			if (!freq && (ast_set_jtag_freq(rec.len) < 0))
+				r.failed++;
+			break;
+		}
+		wait_us = (rec.op == JTAG_TRACE_WAIT) ? rec.len : 0;
+		if (debug) printf("replay %llu: %s %u\n", records - 1, jtag_trace_names[rec.op], rec.len);
+	}
+
+	jtag_replay_report(&r, records, jtag_trace_time_us() - start);
+	if (r.failed)
+		retval = -1;
+out:
+	free(tdi);
+	free(tdo);
+	free(buf);
+	fclose(fp);
+
+	return retval;
+}
@@ -8,266 +8,683 @@
 #include <getopt.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include <sys/mman.h>
 #include "lattice.h"
 #include "ast-jtag.h"
-
-extern struct cpld_dev_info *cur_dev;
+#include "jedec.h"
+#include "crc32.h"
+#include "fuse-pack.h"
+#include "journal.h"
+#include "jed-input.h"
+#include "jed-stream.h"
+#include "jtag-backend.h"
+#include "cpld-stats.h"
+#include "erase-log.h"
+
+extern __thread struct cpld_dev_info *cur_dev;
 extern int debug;
+extern int skip_identical;
+extern int fail_fast;
+extern int program_verify;
+extern int resume;
+extern int background;
+extern volatile sig_atomic_t cpld_stop;
+extern __thread const char *cur_node;
+
+/* Rows read back per queue flush during verify (two queue ops per row) */
+#define VERIFY_ROW_BATCH	(JTAG_SCAN_QUEUE_DEPTH / 2)
+
+/* Mismatching rows printed by the verify summary */
+#define VERIFY_REPORT_ROWS	8
+
+/* Row windows read back for the sampled skip-if-identical check */
+#define SKIP_SAMPLE_WINDOWS	16
+#define SKIP_SAMPLE_ROWS	8
+
+/* rows read on either side of the checkpoint before a resume */
+#define RESUME_CHECK_ROWS	64
+
+/* LSC_READ_STATUS bits */
+#define LATTICE_STATUS_DONE	(1 << 8)
+#define LATTICE_STATUS_FAIL	(1 << 13)
+
+/* Busy poll interval bounds once the learned latency has passed */
+#define BUSY_POLL_MIN_US	50
+#define BUSY_POLL_MAX_US	2000
+
+/* Longer busy periods back off up to this fraction of the latency */
+#define BUSY_POLL_DIV		16
+
+/*
+ * struct lattice_busy_timing - learned busy latency:
+ *
+ * @est_us: running estimate of the busy period
+ * @min_us: shortest busy period seen
+ * @max_us: longest busy period seen
+ * @sum_us: sum of all busy periods
+ * @count: busy periods measured
+ * @polls: LSC_CHECK_BUSY reads issued
+ * @first_us: delay of the first poll, 0 for slightly less than @est_us
+ */
+struct lattice_busy_timing {
+	unsigned int	est_us;
+	unsigned int	min_us;
+	unsigned int	max_us;
+	unsigned long long	sum_us;
+	unsigned int	count;
+	unsigned int	polls;
+	unsigned int	first_us;
+};
+
+/**
+ * struct lattice_verify - verify result:
+ *
+ * @rows: rows compared
+ * @bad_rows: rows that differ from the image
+ * @map: mismatch map, bit n set when row n differs
+ * @buf: readback buffer, VERIFY_ROW_BATCH rows
+ * @bad: first VERIFY_REPORT_ROWS mismatches, first differing word of the row
+ */
+struct lattice_verify {
+	unsigned int	rows;
+	unsigned int	bad_rows;
+	u32		*map;
+	u32		*buf;
+	struct {
+		unsigned int	row;
+		unsigned int	word;
+		u32		jed;
+		u32		sdr;
+	} bad[VERIFY_REPORT_ROWS];
+};
 
 /*************************************************************************************/
 
-int jed_file_get_cfg_bitsize(FILE *jed_fd)
+static unsigned long long lattice_time_us(void)
 {
-	//file
-	char tmp_buf[160];
-	char *ptr;
-	int bitsize = 0;
-
-	fseek(jed_fd, 0, SEEK_SET);
-	//Header paser
-	while (fgets(tmp_buf, 120, jed_fd) != NULL) {
-		ptr = strstr(tmp_buf, "END CONFIG DATA");
-		if (ptr != NULL) {
-			// Get Config Data size "Lxxxxxx"
-			fgets(tmp_buf, 120, jed_fd);
-			sscanf(tmp_buf,"L%06d*",&bitsize);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * lattice_busy_wait: wait for the device to leave busy.
+ * LSC_CHECK_BUSY must already be queued after the operation that starts the
+ * busy period. The first poll is queued right behind it, delayed by slightly
+ * less than the learned latency; later polls back off from BUSY_POLL_MIN_US
+ * to BUSY_POLL_MAX_US, or 1/BUSY_POLL_DIV of the latency when that is more.
+ * Returns 0 when ready, -1 on timeout or xfer error.
+ */
+static int lattice_busy_wait(struct lattice_busy_timing *bt, unsigned int timeout_us)
+{
+	unsigned long long start, elapsed;
+	unsigned int wait_us, step_us, step_max, polls = 0;
+	u32 busy;
+
+	start = lattice_time_us();
+	wait_us = bt->first_us ? bt->first_us : bt->est_us - bt->est_us / 8;
+	step_us = BUSY_POLL_MIN_US;
+	step_max = bt->est_us / BUSY_POLL_DIV;
+	if (step_max < BUSY_POLL_MAX_US)
+		step_max = BUSY_POLL_MAX_US;
+
+	for (;;) {
+		//RUNTEST IDLE	<wait> SEC;
+		//SDR 1 TDI  (0)
+		//		TDO  (0);
+		ast_jtag_queue_runtest(0, wait_us);
+		busy = 0;
+		ast_jtag_queue_tdo(0, 1, &busy);
+		if (ast_jtag_queue_flush() < 0)
+			return -1;
+		bt->polls++;
+		polls++;
+
+		elapsed = lattice_time_us() - start;
+		if (busy == 0)
 			break;
+		if (elapsed >= timeout_us) {
+			cpld_stats_busy(polls);
+			return -1;
 		}
+
+		wait_us = step_us;
+		if (step_us < step_max)
+			step_us *= 2;
 	}
-	printf("CFG DATA bit size: %d\n", bitsize);
-	return bitsize;
+
+	if (bt->count == 0) {
+		bt->est_us = elapsed;
+		bt->min_us = elapsed;
+		bt->max_us = elapsed;
+	} else {
+		bt->est_us = (bt->est_us * 7 + elapsed) / 8;
+		if (elapsed < bt->min_us)
+			bt->min_us = elapsed;
+		if (elapsed > bt->max_us)
+			bt->max_us = elapsed;
+	}
+	bt->sum_us += elapsed;
+	bt->count++;
+	cpld_stats_busy(polls);
+
+	return 0;
 }
 
-u32 jed_file_get_usercode(FILE *jed_fd)
+/*
+ * lattice_enable_x: enter ISC_ENABLE_X, the flash can be read, erased and
+ * programmed while the device keeps running the design it booted with.
+ */
+static int lattice_enable_x(void)
 {
-	//file
-	char tmp_buf[160];
-	char *ptr;
-	u32 userdata = 0;
-
-	//Header paser
-	fseek(jed_fd, 0, SEEK_SET);
-	while (fgets(tmp_buf, 120, jed_fd) != NULL) {
-		ptr = strstr(tmp_buf, "User Electronic Signature");
-		if (ptr != NULL) {
-			// Get Config Data size "Lxxxxxx"
-			fgets(tmp_buf, 120, jed_fd);
-			sscanf(tmp_buf,"UH%08X*",&userdata);
-			break;
+	u32 data;
+
+	//! Enable the Flash in transparent mode
+	//! Shift in ISC_ENABLE_X(0x74) instruction
+	//SIR 8	TDI  (74);
+	//SDR 8	TDI  (08);
+	//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, ISC_ENABLE_X);
+	data = 0x08;
+	ast_jtag_queue_tdi(0, 8, &data);
+	ast_jtag_queue_runtest(2, 1000);
+
+	return ast_jtag_queue_flush();
+}
+
+/*
+ * lattice_read_start: set the CFG address to row and start LSC_READ_INCR_NV.
+ * Row 0 uses LSC_INIT_ADDRESS, other rows LSC_WRITE_ADDRESS with the page.
+ */
+static int lattice_read_start(unsigned int row)
+{
+	u32 addr;
+
+	if (row == 0) {
+		//! Shift in LSC_INIT_ADDRESS(0x46) instruction
+		//SIR 8	TDI  (46);
+		ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_INIT_ADDRESS);
+
+		//SDR 8	TDI  (04);
+		//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
+		addr = 0x04;
+		ast_jtag_queue_tdi(0, 8, &addr);
+		ast_jtag_queue_runtest(2, 1000);
+	} else {
+		//! Shift in LSC_WRITE_ADDRESS(0xB4) instruction
+		//SIR 8	TDI  (B4);
+		ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_WRITE_ADDRESS);
+
+		//SDR 32	TDI  (0000PPPP);
+		//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
+		addr = row & LATTICE_PAGE_MASK;
+		ast_jtag_queue_tdi(0, 32, &addr);
+		ast_jtag_queue_runtest(2, 1000);
+	}
+
+	//! Shift in LSC_READ_INCR_NV(0x73) instruction
+	//SIR 8	TDI  (73);
+	//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_READ_INCR_NV);
+	ast_jtag_queue_runtest(2, 1000);
+
+	return ast_jtag_queue_flush();
+}
+
+/*
+ * lattice_read_next: read the next count rows after lattice_read_start()
+ * into buf, VERIFY_ROW_BATCH rows per queue flush.
+ */
+static int lattice_read_next(unsigned int count, u32 *buf)
+{
+	unsigned int n, words = cur_dev->dr_bits / 32;
+
+	for (n = 0; n < count; n++) {
+		ast_jtag_queue_tdo(0, cur_dev->dr_bits, &buf[n * words]);
+
+		//RUNTEST	IDLE	2 TCK	1.00E-003 SEC;
+		ast_jtag_queue_runtest(2, 1000);
+
+		if (((n + 1) % VERIFY_ROW_BATCH) == 0) {
+			if (ast_jtag_queue_flush() < 0)
+				return -1;
 		}
 	}
-	printf("USER DATA is: 0x%08X\n", userdata);
-	return userdata;
+
+	return ast_jtag_queue_flush();
 }
 
-void jed_file_paser_header(FILE *jed_fd)
+/*
+ * lattice_read_crc: CRC-32 over count rows read back from row on, next to
+ * the CRC-32 of the same rows in the image unless jed_crc is NULL.
+ */
+static int lattice_read_crc(struct jed_file *jed, unsigned int row, unsigned int count,
+			    u32 *dev_crc, u32 *jed_crc)
 {
-	//file
-	char tmp_buf[160];
+	unsigned int words = cur_dev->dr_bits / 32;
+	unsigned int n;
+	u32 *buf;
 
-	//Header paser
-	while (fgets(tmp_buf, 120, jed_fd) != NULL) {
-//		if (debug) printf("%s \n", tmp_buf);
-		if (tmp_buf[0] == 0x4C) { // "L"
-			break;
+	buf = malloc(VERIFY_ROW_BATCH * words * sizeof(u32));
+	if (!buf)
+		return -1;
+
+	if (lattice_read_start(row) < 0) {
+		free(buf);
+		return -1;
+	}
+
+	while (count) {
+		n = count > VERIFY_ROW_BATCH ? VERIFY_ROW_BATCH : count;
+		if (lattice_read_next(n, buf) < 0) {
+			free(buf);
+			return -1;
 		}
+		*dev_crc = crc32_update(*dev_crc, buf, n * words * sizeof(u32));
+		if (jed_crc)
+			*jed_crc = crc32_update(*jed_crc, &jed->fuse[row * words], n * words * sizeof(u32));
+		row += n;
+		count -= n;
 	}
+
+	free(buf);
+
+	return 0;
 }
 
-void jed_file_paser(FILE *jed_fd, unsigned int len, u32 *dr_data)
+/*
+ * lattice_verify_init: set up the mismatch map for rows rows.
+ */
+static int lattice_verify_init(struct lattice_verify *vr, unsigned int rows)
 {
-	int i = 0;
-	unsigned char input_char, input_bit;
-	int sdr_array = 0, data_bit = 0, bit_cnt = 0;
-	int err_flag;
-
-	if (debug) printf("file len = %d \n", len);
-	//Jed row
-	for (i = 0; i < len; i++) {
-		input_char = fgetc(jed_fd);
-		if ((input_char == 0x30) || (input_char == 0x31)) { // "0", "1"
-//			printf("%c", input_char);
-			if (input_char == 0x30) {
-				input_bit = 0;
-			} else {
-				input_bit = 1;
-			}
-//			if (debug) printf(" %d ", input_bit);
-			dr_data[sdr_array] |= (((u32) input_bit) << data_bit);
-//			if (debug) printf("dr_data[%d]=%llx, data_bit=%d\n", sdr_array, dr_data[sdr_array], data_bit);
-			data_bit++;
-			bit_cnt++;
-
-			if ((data_bit % 32) == 0) {
-				if (debug) printf(" [%i] : %x \n", sdr_array, dr_data[sdr_array]);
-				data_bit = 0;
-				sdr_array++;
+	memset(vr, 0, sizeof(*vr));
+	vr->rows = rows;
+	vr->map = calloc((rows + 31) / 32, sizeof(u32));
+	vr->buf = malloc(VERIFY_ROW_BATCH * (cur_dev->dr_bits / 32) * sizeof(u32));
+	if (!vr->map || !vr->buf) {
+		free(vr->map);
+		free(vr->buf);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void lattice_verify_free(struct lattice_verify *vr)
+{
+	free(vr->map);
+	free(vr->buf);
+}
+
+/*
+ * lattice_verify_rows: read count rows from row on, after
+ * lattice_read_start(row), and compare them with the image. Mismatching rows
+ * are marked in the map. Returns -1 on a JTAG error, or at the first
+ * mismatch with fail_fast set.
+ */
+static int lattice_verify_rows(struct lattice_verify *vr, struct jed_file *jed,
+			       unsigned int row, unsigned int count)
+{
+	unsigned int words = cur_dev->dr_bits / 32;
+	unsigned int n, batch;
+	int i;
+
+	while (count) {
+		batch = count > VERIFY_ROW_BATCH ? VERIFY_ROW_BATCH : count;
+		if (lattice_read_next(batch, vr->buf) < 0)
+			return -1;
+
+		for (n = 0; n < batch; n++, row++) {
+			i = jed_row_cmp(&vr->buf[n * words], &jed->fuse[row * words], words);
+			if (i < 0)
+				continue;
+
+			vr->map[row / 32] |= 1u << (row % 32);
+			if (vr->bad_rows < VERIFY_REPORT_ROWS) {
+				vr->bad[vr->bad_rows].row = row;
+				vr->bad[vr->bad_rows].word = i;
+				vr->bad[vr->bad_rows].jed = jed->fuse[row * words + i];
+				vr->bad[vr->bad_rows].sdr = vr->buf[n * words + i];
 			}
-			err_flag = 0;
-		} else if (input_char == 0xd) {
-			//printf(" ");
-			i--;
-//			printf("paser error [%x]\n", input_char);
-		} else if (input_char == 0xa) {
-			i--;
-			//printf("\n");
-//			printf("paser error [%x]\n", input_char);
-		} else {
-			printf("paser errorxx [%x : %c] \n", input_char, input_char);
-			printf("%c", input_char);
-			err_flag = 1;
-			break;
+			vr->bad_rows++;
+			if (fail_fast)
+				return -1;
 		}
+		count -= batch;
 	}
-	if (debug) printf(" [%i] : %llx , Total %d \n", sdr_array, dr_data[sdr_array], bit_cnt);
-	
-	if (bit_cnt != len) {
-		if(err_flag) {
-			printf("\n");
-		} else {
-			printf("File Error - bit_cnt %d, len %d\n", bit_cnt, len);
+
+	return 0;
+}
+
+static void lattice_verify_report(struct lattice_verify *vr)
+{
+	unsigned int i, n;
+
+	if (!vr->bad_rows)
+		return;
+
+	printf("%u of %u rows differ%s\n", vr->bad_rows, vr->rows,
+	       fail_fast ? ", stopped at the first one" : "");
+
+	n = vr->bad_rows < VERIFY_REPORT_ROWS ? vr->bad_rows : VERIFY_REPORT_ROWS;
+	for (i = 0; i < n; i++)
+		printf("row %u, fuse %u : JED %08x, SDR %08x\n", vr->bad[i].row,
+		       vr->bad[i].row * cur_dev->dr_bits + vr->bad[i].word * 32,
+		       vr->bad[i].jed, vr->bad[i].sdr);
+
+	if (debug) {
+		printf("Mismatch map:");
+		for (i = 0; i < (vr->rows + 31) / 32; i++)
+			printf("%s%08x", (i % 8) ? " " : "\n", vr->map[i]);
+		printf("\n");
+	}
+}
+
+/*
+ * lattice_image_identical: compare the device with the image before erase.
+ * USERCODE is compared first; CPLD_SKIP_SAMPLE then compares the CRC of
+ * SKIP_SAMPLE_WINDOWS evenly spread row windows, CPLD_SKIP_FULL the CRC of
+ * all rows. A device without DONE, or with FAIL, set does not boot what its
+ * flash holds and is never taken as identical. Returns 1 when the device
+ * holds the image, 0 when not.
+ */
+static int lattice_image_identical(struct jed_file *jed, int level)
+{
+	u32 usercode, status, dev_crc = 0, jed_crc = 0;
+	unsigned int w, row, count, rows = cur_dev->row_num;
+
+	//! Shift in READ USERCODE(0xC0) instruction
+	//SIR 8	TDI  (C0);
+	//SDR 32	TDI  (00000000)
+	//		TDO  (UUUUUUUU);
+	usercode = 0;
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, USERCODE);
+	ast_jtag_queue_tdo(0, 32, &usercode);
+	if (ast_jtag_queue_flush() < 0)
+		return 0;
+
+	printf("Device USERCODE 0x%08X, image 0x%08X\n", usercode, jed->usercode);
+	if (usercode != jed->usercode)
+		return 0;
+
+	if (level == CPLD_SKIP_FULL) {
+		if (lattice_read_crc(jed, 0, rows, &dev_crc, &jed_crc) < 0)
+			return 0;
+	} else if (level == CPLD_SKIP_SAMPLE) {
+		count = (rows < SKIP_SAMPLE_ROWS) ? rows : SKIP_SAMPLE_ROWS;
+		for (w = 0; w < SKIP_SAMPLE_WINDOWS; w++) {
+			row = (unsigned long long) (rows - count) * w / (SKIP_SAMPLE_WINDOWS - 1);
+			if (lattice_read_crc(jed, row, count, &dev_crc, &jed_crc) < 0)
+				return 0;
 		}
 	}
-//	} while (input_char != 0x2A); // "*"
 
+	if (level >= CPLD_SKIP_SAMPLE) {
+		printf("Device %s CRC32 0x%08X, image 0x%08X\n",
+		       level == CPLD_SKIP_FULL ? "full" : "sampled", dev_crc, jed_crc);
+		if (dev_crc != jed_crc)
+			return 0;
+	}
+
+	//! Shift in LSC_READ_STATUS(0x3C) instruction
+	//SIR 8	TDI  (3C);
+	//SDR 32	TDO  (00000100)
+	//		MASK (00002100);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_READ_STATUS);
+	ast_jtag_queue_runtest(2, 1000);
+	status = 0;
+	ast_jtag_queue_tdo(0, 32, &status);
+	if (ast_jtag_queue_flush() < 0)
+		return 0;
+	if (!(status & LATTICE_STATUS_DONE) || (status & LATTICE_STATUS_FAIL)) {
+		printf("Device status 0x%08X, DONE %s, FAIL %s\n", status,
+		       (status & LATTICE_STATUS_DONE) ? "set" : "clear",
+		       (status & LATTICE_STATUS_FAIL) ? "set" : "clear");
+		return 0;
+	}
+
+	return 1;
 }
 
 /*
- * bitStr2hex_fsm
+ * lattice_program_verify: --program-verify, read the CFG rows and the
+ * USERCODE back while still in programming mode, before DONE. A streamed
+ * image no longer holds its rows, those are checked against prog_crc, the
+ * CRC-32 of the rows as they were shifted in.
  */
-static unsigned int bitStr2hex_fsm(unsigned int cmd){
-	static unsigned int data =0;
-	static unsigned int bits =0;
-	unsigned int ret = 0;
-
-	switch(cmd){
-	case BITS_FSM_BITS:
-		ret = bits;
-		break;
-	case BITS_FSM_RESET:
-		data = 0;
-		bits = 0;
-		break;
-	case BITS_FSM_PUSH_HighBIT:
-		if(bits < 32){
-			data |= 1 << bits;
-			bits++;
-		}
-		break;
-	case BITS_FSM_PUSH_ZeroBIT:
-		if(bits < 32){
-			bits++;
-		}
-		break;
-	case BITS_FSM_READ:
-		ret = data;
-		break;
-	case '\n':
-	case '\r':
-		break;
-	default://'*', '\0' or others.
-		ret = -1;
-		break;
+static int lattice_program_verify(struct jed_file *jed, unsigned int rows, u32 prog_crc)
+{
+	struct lattice_verify vr;
+	u32 usercode, dev_crc = 0;
+	int retval = 0;
+
+	cpld_stats_phase(CPLD_PHASE_VERIFY);
+	printf("Verify CONFIG %d \n", rows);
+	if (jed->stream) {
+		if (lattice_read_crc(jed, 0, rows, &dev_crc, NULL) < 0)
+			return -1;
+		printf("Device CRC32 0x%08X, programmed 0x%08X\n", dev_crc, prog_crc);
+		if (dev_crc != prog_crc)
+			retval = -1;
+	} else {
+		if (lattice_verify_init(&vr, rows) < 0)
+			return -1;
+		if ((lattice_read_start(0) < 0) || (lattice_verify_rows(&vr, jed, 0, rows) < 0))
+			retval = -1;
+		lattice_verify_report(&vr);
+		if (vr.bad_rows)
+			retval = -1;
+		lattice_verify_free(&vr);
 	}
 
-	return ret;
+	//! Shift in READ USERCODE(0xC0) instruction
+	//SIR 8	TDI  (C0);
+	//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
+	//SDR 32	TDI  (00000000)
+	//		TDO  (UUUUUUUU);
+	usercode = 0;
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, USERCODE);
+	ast_jtag_queue_runtest(2, 1000);
+	ast_jtag_queue_tdo(0, 32, &usercode);
+	if (ast_jtag_queue_flush() < 0)
+		return -1;
+	printf("Verify USERCODE 0x%08X [0x%08X]\n", usercode, jed->usercode);
+	if (usercode != jed->usercode)
+		retval = -1;
+
+	cpld_stats_phase(CPLD_PHASE_FINISH);
+
+	return retval;
 }
 
-static unsigned int pick_bits(FILE *jed_fd, u32 *hex_buf,int range){
-
-	unsigned int index=0;
-	unsigned int ret=0;
-	unsigned char input_char;
-
-	bitStr2hex_fsm( BITS_FSM_RESET );
-	//read until char is end(* or '\0')
-	input_char = fgetc(jed_fd);
-//	printf("CFG data is: \n");
-	while(bitStr2hex_fsm(input_char) != -1 && range-- >0){
-		if(bitStr2hex_fsm( BITS_FSM_BITS ) == 32) {
-			hex_buf[index++] = bitStr2hex_fsm(BITS_FSM_READ);
-//			printf(" %x ", bitStr2hex_fsm(BITS_FSM_READ));
-//			if (index % 10 == 0)
-//				printf("\n");
-			bitStr2hex_fsm(BITS_FSM_RESET);
+/*
+ * lattice_resume_row: check the device is where the journal left it and
+ * return the first row still to program, -1 if it is not. The DONE bit
+ * must be clear and the rows before the checkpoint must hold the image.
+ * The journal lags the device by up to CPLD_JOURNAL_ROWS rows, so from the
+ * checkpoint on the rows may still match the image; from the first one
+ * that does not, RESUME_CHECK_ROWS rows must read erased.
+ */
+static int lattice_resume_row(struct jed_file *jed, unsigned int next_row)
+{
+	unsigned int words = cur_dev->dr_bits / 32, rows = cur_dev->row_num;
+	unsigned int row, n, i, w, erased = 0;
+	u32 status, dev_crc = 0, jed_crc = 0;
+	u32 *buf, *dev;
+	int start = -1;
+
+	//! Shift in LSC_READ_STATUS(0x3C) instruction
+	//SIR 8	TDI  (3C);
+	//SDR 32	TDO  (00000000)
+	//		MASK (00000100);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_READ_STATUS);
+	ast_jtag_queue_runtest(2, 1000);
+	status = 0;
+	ast_jtag_queue_tdo(0, 32, &status);
+	if (ast_jtag_queue_flush() < 0)
+		return -1;
+	if (status & LATTICE_STATUS_DONE) {
+		printf("Resume: DONE bit is set, the device is not partly programmed\n");
+		return -1;
+	}
+
+	if (next_row > rows)
+		return -1;
+
+	//the rows before the checkpoint
+	if (next_row) {
+		n = next_row > RESUME_CHECK_ROWS ? RESUME_CHECK_ROWS : next_row;
+		if ((lattice_read_crc(jed, next_row - n, n, &dev_crc, &jed_crc) < 0) ||
+		    (dev_crc != jed_crc)) {
+			printf("Resume: rows %d to %d do not hold the image\n", next_row - n, next_row - 1);
+			return -1;
 		}
-		input_char = fgetc(jed_fd);
 	}
 
-	ret=index << 2;
-	if(bitStr2hex_fsm( BITS_FSM_BITS ) != 0) {
-		hex_buf[index++] = bitStr2hex_fsm(BITS_FSM_READ);
-		ret += bitStr2hex_fsm( BITS_FSM_BITS ) >> 3;
-		ret |= (bitStr2hex_fsm( BITS_FSM_BITS ) % 8) << 24;  //move the redundant bits in the MSB of "ret"
-		bitStr2hex_fsm(BITS_FSM_RESET);
+	buf = malloc(VERIFY_ROW_BATCH * words * sizeof(u32));
+	if (!buf)
+		return -1;
+
+	//the rows after it, programmed from the image up to start, then erased
+	if (lattice_read_start(next_row) < 0)
+		goto fail;
+	for (row = next_row; (row < rows) && (erased < RESUME_CHECK_ROWS); row += n) {
+		n = (rows - row > VERIFY_ROW_BATCH) ? VERIFY_ROW_BATCH : rows - row;
+		if (lattice_read_next(n, buf) < 0)
+			goto fail;
+
+		for (i = 0; (i < n) && (erased < RESUME_CHECK_ROWS); i++) {
+			dev = &buf[i * words];
+			if ((start < 0) && !memcmp(dev, &jed->fuse[(row + i) * words], words * sizeof(u32)))
+				continue;
+			if (start < 0)
+				start = row + i;
+			for (w = 0; w < words; w++) {
+				if (dev[w]) {
+					printf("Resume: row %d is neither erased nor from the image\n", row + i);
+					goto fail;
+				}
+			}
+			erased++;
+		}
 	}
+	free(buf);
 
-	return ret;
+	return start < 0 ? (int) rows : start;
+fail:
+	free(buf);
+	return -1;
 }
 
-static u8 *jed_ami(FILE *jed_fd)
+/*
+ * lattice_resume: load the journal for this node and, if it belongs to the
+ * device and the image, return the row to resume programming at.
+ */
+static int lattice_resume(struct jed_file *jed, struct cpld_journal *j)
 {
-	int i, total_bitsize;
-	u8 *buff, *ptr;
-	u8 redunant_bits;
-	u32 shift, crc, len;
-
-	crc = 0;
-	total_bitsize = jed_file_get_cfg_bitsize(jed_fd);
-
-	buff = malloc((total_bitsize/8 + 1) * sizeof(u8));
-	memset(buff, 0, (total_bitsize/8 + 1) * sizeof(u8));
-
-	fseek(jed_fd, 0, SEEK_SET);
-	jed_file_paser_header(jed_fd);
-	shift = 0;
-	shift  += pick_bits(jed_fd, (u32 *) buff, 835328);
-	redunant_bits= (unsigned char)(shift >> 24);
-//	printf("shift=%d, redunt=%d\n", shift, redunant_bits);
-	shift &= 0x00ffffff;
-	len = shift*8 + redunant_bits;
-//	printf("###CFG data size is: %d\n", len);
-	len = len / 8;
-	ptr = buff;
-//	printf("CRC data is: \n");
-	for (i = 0; i < len; i++) {
-		crc += *ptr++;
-//		if (i %128 == 0)
-//			printf("0x%x\n", crc);
+	struct cpld_journal old;
+
+	if (cpld_journal_load(cur_node, &old) < 0) {
+		printf("Resume: no journal for %s\n", cur_node);
+		return -1;
+	}
+	if ((old.dev_id != j->dev_id) || (old.image_crc != j->image_crc) ||
+	    (old.usercode != j->usercode) || (old.rows != j->rows)) {
+		printf("Resume: journal is for another device or image\n");
+		return -1;
 	}
-	crc &= 0xFFFF;
-	printf("###Checksum count 0x%x\n", crc);
 
-	return buff;
+	return lattice_resume_row(jed, old.next_row);
 }
 
-int llcmxo2_4000hc_cpld_program(FILE *jed_fd)
+int llcmxo2_4000hc_cpld_program(struct jed_file *jed)
 {
-	int i, index;
+	int index;
 	u32 dr_data, user_data;
 	u32 ir_tdi_data;
 	u32 ir_tdo_data;
-	int total_bitsize;
-	u8 *ptr_data;
+	u32 *ptr_data, *row_data;
+	struct lattice_busy_timing row_timing, done_timing;
+	struct cpld_journal journal;
+	unsigned long long row_start;
+	unsigned int row_polls;
+	u32 prog_crc = 0;
+	int start = -1;
+	//a streamed image has no CRC-32 before the last row, no journal
+	int journaled = !jed->stream;
 
 	unsigned int row  = 0;
+	memset(&row_timing, 0, sizeof(row_timing));
+	//the first poll goes out near the typical time, later ones as measured
+	row_timing.est_us = cur_dev->timing.prog;
 	index = 0;
 
-	lcmxo2_4000hc_cpld_erase();
+	if (jed->stream && !jed->cfg_bits) {
+		printf("CFG DATA streamed, at most %d rows\n", cur_dev->row_num);
+	} else {
+		printf("CFG DATA bit size: %d\n", jed->cfg_bits);
+		printf("USER DATA is: 0x%08X\n", jed->usercode);
+		cur_dev->row_num = jed->cfg_bits / cur_dev->dr_bits;
+	}
+	user_data = jed->usercode;
+	printf("cur_dev->row_num is %d\n", cur_dev->row_num);
+
+	if (skip_identical && lattice_image_identical(jed, skip_identical)) {
+		printf("Device already holds this image, skip erase and program\n");
 
-	total_bitsize = jed_file_get_cfg_bitsize(jed_fd);
-	user_data = jed_file_get_usercode(jed_fd);
+		//! Shift in ISC DISABLE(0x26) instruction
+		//SIR 8	TDI  (26);
+		//! Shift in BYPASS(0xFF) instruction
+		//SIR 8	TDI  (FF);
+		ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, ISC_DISABLE);
+		ast_jtag_queue_runtest(2, 1000);
+		ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, BYPASS);
+		ast_jtag_queue_flush();
 
-	cur_dev->row_num = total_bitsize / cur_dev->dr_bits;
-	printf("cur_dev->row_num is %d\n", cur_dev->row_num);
+		return CPLD_UP_TO_DATE;
+	}
+
+	memset(&journal, 0, sizeof(journal));
+	journal.magic = CPLD_JOURNAL_MAGIC;
+	journal.version = CPLD_JOURNAL_VERSION;
+	journal.size = sizeof(journal);
+	journal.dev_id = cur_dev->dev_id;
+	journal.image_crc = jed->crc32;
+	journal.usercode = jed->usercode;
+	journal.rows = cur_dev->row_num;
+
+	if (resume)
+		start = lattice_resume(jed, &journal);
+
+	if (start < 0) {
+		if (resume)
+			printf("Cannot resume, erase and program from the start\n");
+		cpld_stats_phase(CPLD_PHASE_ERASE);
+		if (lcmxo2_4000hc_cpld_erase() < 0)
+			return -1;
+		start = 0;
+		if (journaled)
+			cpld_journal_save(cur_node, &journal);
+	} else {
+		printf("Resume at row %d of %d\n", start, cur_dev->row_num);
+		journal.next_row = start;
+	}
 
-	ptr_data = jed_ami(jed_fd);
+	ptr_data = jed->fuse;
 
 	//! Program CFG
 
 	printf("Program CFG \n");
+	cpld_stats_phase(CPLD_PHASE_PROGRAM);
+
+	//the erase left programming mode
+	if (background)
+		lattice_enable_x();
 
 	//! Shift in LSC_INIT_ADDRESS(0x46) instruction
 	//SIR 8	TDI  (46);
@@ -279,50 +696,109 @@ int llcmxo2_4000hc_cpld_program(FILE *jed_fd)
 	dr_data = 0x04;
 	ast_jtag_tdi_xfer(0, 8, &dr_data);
 
+	if (start) {
+		//! Shift in LSC_WRITE_ADDRESS(0xB4) instruction
+		//SIR 8	TDI  (B4);
+		//SDR 32	TDI  (0000PPPP);
+		//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
+		ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_WRITE_ADDRESS);
+		dr_data = start & LATTICE_PAGE_MASK;
+		ast_jtag_queue_tdi(0, 32, &dr_data);
+		ast_jtag_queue_runtest(2, 1000);
+		ast_jtag_queue_flush();
+	}
+	index = start * (cur_dev->dr_bits / 32);
+
 	printf("Program 9212 .. \n");
 
 //	system("echo 1 > /sys/class/gpio/gpio10/value");
 
 //	mode = SW_MODE;
-	for (row = 0 ; row < cur_dev->row_num; row++) {
+	for (row = start; row < cur_dev->row_num; row++) {
+		if (cpld_stop) {
+			if (!journaled) {
+				printf("\nStopped at row %d\n", row);
+				return -1;
+			}
+			journal.next_row = row;
+			cpld_journal_save(cur_node, &journal);
+			printf("\nStopped at row %d, run again with --resume\n", journal.next_row);
+			return -1;
+		}
+
+		if (jed->stream) {
+			row_data = jed_stream_next(jed->stream);
+			if (!row_data)
+				break;
+			if (program_verify)
+				prog_crc = crc32_update(prog_crc, row_data, cur_dev->dr_bits / 8);
+		} else {
+			row_data = &ptr_data[index];
+		}
+
+		// The row shift, the busy check and the first busy poll are queued
+		// and run by the busy wait's flush.
+		row_start = lattice_time_us();
+		row_polls = row_timing.polls;
+
 		//! Shift in LSC_PROG_INCR_NV(0x70) instruction
 		//SIR 8 TDI  (70);
-		ir_tdi_data = 0x70;
-		ast_jtag_sir_xfer(1, LATTICE_INS_LENGTH, &ir_tdi_data, &ir_tdo_data);
-
+		ast_jtag_queue_sir(1, LATTICE_INS_LENGTH, LSC_PROG_INCR_NV);
 
 		//! Shift in Data Row = 1
 		//SDR 128 TDI  (120600000040000000DCFFFFCDBDFFFF);
 		//RUNTEST IDLE	2 TCK;
-		ast_jtag_tdi_xfer(0, cur_dev->dr_bits, (u32 *) &ptr_data[index]);
-		usleep(1000);
+		ast_jtag_queue_tdi(0, cur_dev->dr_bits, row_data);
 
 		//! Shift in LSC_CHECK_BUSY(0xF0) instruction
 		//SIR 8 TDI  (F0);
-		ir_tdi_data = 0xF0;
-		ast_jtag_sir_xfer(1, LATTICE_INS_LENGTH, &ir_tdi_data, &ir_tdo_data);
+		ast_jtag_queue_sir(1, LATTICE_INS_LENGTH, LSC_CHECK_BUSY);
 
 		//LOOP 10 ;
 		//RUNTEST IDLE	1.00E-003 SEC;
 		//SDR 1 TDI  (0)
 		//		TDO  (0);
 		//ENDLOOP ;
-		for (i = 0; i < 10; i++) {
-			usleep(3000);
-			dr_data = 0;
-			ast_jtag_tdo_xfer(0, 1, &dr_data);
-			if (dr_data == 0) break;
+		if (lattice_busy_wait(&row_timing, cur_dev->timing.prog_max) < 0) {
+			printf("\nrow %d, Fail [busy]\n", row);
+			if (!journaled)
+				return -1;
+			//the checkpoint stays before this row
+			cpld_journal_save(cur_node, &journal);
+			printf("Stopped at row %d, run again with --resume\n", journal.next_row);
+			return -1;
+		}
+		printf(".");
+		cpld_stats_row(row, lattice_time_us() - row_start, row_timing.polls - row_polls);
+		//the busy wait flushed the queue, the row is shifted
+		if (jed->stream)
+			jed_stream_release(jed->stream);
+		if (journaled && (((row + 1) % CPLD_JOURNAL_ROWS) == 0)) {
+			journal.next_row = row + 1;
+			cpld_journal_save(cur_node, &journal);
 		}
-
-		if (dr_data != 0)
-			printf("row %d, Fail [%d] \n", row, dr_data);
-		else
-			printf(".");
 		index += cur_dev->dr_bits / 32;
 
 	}
 //	mode = HW_MODE;
 	printf("\nDone\n");
+	cpld_stats_phase(CPLD_PHASE_FINISH);
+	if (row_timing.count)
+		printf("Row program time: avg %llu us, min %u us, max %u us, %u busy polls\n",
+		       row_timing.sum_us / row_timing.count, row_timing.min_us,
+		       row_timing.max_us, row_timing.polls);
+
+	if (jed->stream) {
+		//more rows than the device has, or the file changed since its check
+		if (((row == cur_dev->row_num) && jed_stream_next(jed->stream)) ||
+		    (jed_stream_close(jed->stream) < 0) ||
+		    (row != (jed->cfg_bits + cur_dev->dr_bits - 1) / cur_dev->dr_bits)) {
+			printf("Image Error after %d rows, USERCODE and DONE not programmed\n", row);
+			return -1;
+		}
+		user_data = jed->usercode;
+		printf("CFG DATA bit size: %d, USER DATA is: 0x%08X\n", jed->cfg_bits, user_data);
+	}
 #if 0
 	//! Program the UFM
 	printf("Program the UFM : 2048\n");
@@ -402,9 +878,17 @@ int llcmxo2_4000hc_cpld_program(FILE *jed_fd)
 	//		MASK (00003000);
 	dr_data = 0x00000000;
 	ast_jtag_tdo_xfer(0, 32, &dr_data);
-	if(dr_data != 0x0) printf("Read the status error %x \n", dr_data);
+	if(dr_data & 0x00003000) printf("Read the status error %x \n", dr_data);
 	printf("Prgram usercode status: 0x%x\n", dr_data & 0x00003000);
 
+	//the image is checked before DONE, as the Diamond SVF does
+	if (program_verify && (lattice_program_verify(jed, row, prog_crc) < 0)) {
+		printf("Verify Fail, DONE not programmed\n");
+		//what was programmed is no checkpoint to resume from
+		cpld_journal_clear(cur_node);
+		return -1;
+	}
+
 #if 0
 	//! Program Feature Rows
 
@@ -510,18 +994,17 @@ int llcmxo2_4000hc_cpld_program(FILE *jed_fd)
 
 	//! Shift in LSC_CHECK_BUSY(0xF0) instruction
 	//SIR 8	TDI  (F0);
-	ir_tdi_data = 0xF0;
-	ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, &ir_tdi_data, &ir_tdo_data);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_CHECK_BUSY);
 
 	//LOOP 10 ;
 	//RUNTEST IDLE	1.00E-003 SEC;
 	//SDR 1	TDI  (0)
 	//		TDO  (0);
 	//ENDLOOP ;
-	for (i = 0; i < 10; i++) {
-		usleep(3000);
-		dr_data = 0;
-		ast_jtag_tdo_xfer(0, 1, &dr_data);
+	memset(&done_timing, 0, sizeof(done_timing));
+	if (lattice_busy_wait(&done_timing, cur_dev->timing.done) < 0) {
+		printf("DONE Fail [busy] \n");
+		return -1;
 	}
 
 	//! Shift in BYPASS(0xFF) instruction
@@ -545,28 +1028,24 @@ int llcmxo2_4000hc_cpld_program(FILE *jed_fd)
 	ir_tdi_data = 0xFF;
 	ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, &ir_tdi_data, &ir_tdo_data);
 
-	free(ptr_data);
+	cpld_journal_clear(cur_node);
+
+	if (background)
+		printf("Programmed in background, the new design runs after --refresh\n");
 
 	return 0;
 
 }
 
-int lcmxo2_4000hc_cpld_verify(FILE *jed_fd)
+int lcmxo2_4000hc_cpld_verify(struct jed_file *jed)
 {
-	int i, index;
-	u32 data = 0;
-	u8 *jed_data,* read_data;
+	struct lattice_verify vr;
 	u32 dr_data;
 	u32 ir_tdi_data;
 	u32 ir_tdo_data;
-	unsigned int row  = 0;
 	int cmp_err = 0;
 	u32 *sdr_data;
 	int sdr_array;
-	u16 crc_jed = 0;
-	u16 crc_data = 0;
-	u8 *ptr_jed, *ptr_data;
-	u32 total_bitsize, user_data;
 
 	//RUNTEST	IDLE	15 TCK	1.00E-003 SEC;
 	ast_jtag_run_test_idle(0, 0, 3);
@@ -582,8 +1061,8 @@ int lcmxo2_4000hc_cpld_verify(FILE *jed_fd)
 	//		MASK (FFFFFFFF);
 	ast_jtag_tdo_xfer(0, 32, &dr_data);
 
-	if (dr_data != 0x12BC043) {
-		printf("ID Fail : %08x [0x012B5043] \n", dr_data);
+	if (dr_data != cur_dev->dev_id) {
+		printf("ID Fail : %08x [0x%08X] \n", dr_data, cur_dev->dev_id);
 		return -1;
 	}
 #if 0
@@ -647,64 +1126,33 @@ int lcmxo2_4000hc_cpld_verify(FILE *jed_fd)
 	//! Verify the Flash
 	printf("Starting to Verify Device . . . This will take a few seconds\n");
 
+	printf("CFG DATA bit size: %d\n", jed->cfg_bits);
+	printf("USER DATA is: 0x%08X\n", jed->usercode);
+
+	cur_dev->row_num = jed->cfg_bits / cur_dev->dr_bits;
+	if (lattice_verify_init(&vr, cur_dev->row_num) < 0)
+		return -1;
+
 	//! Shift in LSC_INIT_ADDRESS(0x46) instruction
 	//SIR 8	TDI  (46);
-	ir_tdi_data = 0x46;
-	ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, &ir_tdi_data, &ir_tdo_data);
-
 	//SDR 8	TDI  (04);
 	//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
-	data = 0x04;
-	ast_jtag_tdi_xfer(0, 8, &data);
-//	ast_jtag_run_test_idle( 0, 0, 2);
-	jtag_runtest_idle(2,1);
-//	usleep(3000);
-
 	//! Shift in LSC_READ_INCR_NV(0x73) instruction
 	//SIR 8	TDI  (73);
 	//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
-	ir_tdi_data = 0x73;
-	ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, &ir_tdi_data, &ir_tdo_data);
-//	ast_jtag_run_test_idle( 0, 0, 2);
-//	usleep(3000);
-	jtag_runtest_idle(2,1);
-
-	total_bitsize = jed_file_get_cfg_bitsize(jed_fd);
-	user_data = jed_file_get_usercode(jed_fd);
-
-	cur_dev->row_num = total_bitsize / cur_dev->dr_bits;
-	jed_data = jed_ami(jed_fd);
-	read_data = malloc((total_bitsize/8 + 1) * sizeof(u8));
-	memset(read_data, 0, (total_bitsize/8 + 1) * sizeof(u8));
-
-	printf("Verify CONFIG 9192 \n");
-	cmp_err = 0;
-	row = 0;
-	index = 0;
-
-	for (row = 0 ; row < cur_dev->row_num; row++) {
-//		printf("%d \n", row);
-		ast_jtag_tdo_xfer(0, cur_dev->dr_bits, (u32 *) &read_data[index]);
-
-		for (i = 0; i < (cur_dev->dr_bits / 32); i++) {
-			if (read_data[i] != jed_data[i]) {
-				printf("JED : %x, SDR : %x \n", jed_data[i], read_data[i]);
-				cmp_err = 1;
-			}
-		}
-
-		//RUNTEST	IDLE	2 TCK	1.00E-003 SEC;
-//		ast_jtag_run_test_idle( 0, 0, 2);
-//		usleep(3000);
-		jtag_runtest_idle(2,1);
-//		printf("\n");
-//		if (cmp_err) {
-//			goto cmp_error;
-//			break;
-//		}
-		index += cur_dev->dr_bits / 32;
+	if (lattice_read_start(0) < 0) {
+		lattice_verify_free(&vr);
+		return -1;
 	}
 
+	printf("Verify CONFIG %d \n", cur_dev->row_num);
+	if (lattice_verify_rows(&vr, jed, 0, cur_dev->row_num) < 0)
+		cmp_err = 1;
+	lattice_verify_report(&vr);
+	if (vr.bad_rows)
+		cmp_err = 1;
+	lattice_verify_free(&vr);
+
 #if 0
 	//! Verify the UFM
 
@@ -887,21 +1335,69 @@ int lcmxo2_4000hc_cpld_verify(FILE *jed_fd)
 		printf("BYPASS error %x \n", ir_tdo_data & 0xff);
 
 
-cmp_error:
-	free(jed_data);
-	free(read_data);
-	if (cmp_err)
+	if (cmp_err) {
 		printf("Verify Error !!\n");
-	else
-		printf("Verify Done !!\n");
+		return -1;
+	}
+
+	printf("Verify Done !!\n");
 
 	return 0;
 
 }
 
+/*
+ * lattice_erase_wait: wait out ISC_ERASE, LSC_CHECK_BUSY queued behind it.
+ * The erase is expected to take the logged average of the device, or the
+ * typical erase of the part before the first one, or less when a later
+ * erase was done sooner. Half of that is slept in a single wait before the
+ * first poll, so the poll normally finds the device busy and the erase
+ * is measured. Fails past erase_max of the part. The time taken goes to
+ * the stats and the erase log, as an upper bound when the first poll
+ * already found the erase done.
+ */
+static int lattice_erase_wait(void)
+{
+	struct lattice_busy_timing erase_timing;
+	struct cpld_erase_log log;
+	unsigned int expect;
+	int measured;
+
+	expect = cur_dev->timing.erase;
+	if (cur_node && (cpld_erase_log_get(cur_node, cur_dev->dev_id, &log) == 0)) {
+		if (log.count)
+			expect = log.avg_us;
+		if (log.bound_us && (log.bound_us < expect))
+			expect = log.bound_us;
+	}
+	if (expect > cur_dev->timing.erase_max)
+		expect = cur_dev->timing.erase_max;
+
+	//LOOP 350 ;
+	//RUNTEST IDLE	2 TCK	1.00E-002 SEC;
+	//SDR 1	TDI  (0)
+	//		TDO  (0);
+	//ENDLOOP ;
+	memset(&erase_timing, 0, sizeof(erase_timing));
+	erase_timing.est_us = expect;
+	erase_timing.first_us = expect / 2;
+	if (lattice_busy_wait(&erase_timing, cur_dev->timing.erase_max) < 0) {
+		printf("Erase Fail [busy after %u us] \n", cur_dev->timing.erase_max);
+		return -1;
+	}
+
+	measured = erase_timing.polls > 1;
+	printf("Erase time: %s%u us, expected %u us, %u polls\n", measured ? "" : "at most ",
+	       erase_timing.est_us, expect, erase_timing.polls);
+	cpld_stats_erase(erase_timing.est_us, expect, erase_timing.polls, !measured);
+	if (cur_node)
+		cpld_erase_log_put(cur_node, cur_dev->dev_id, erase_timing.est_us, measured);
+
+	return 0;
+}
+
 int lcmxo2_4000hc_cpld_erase(void)
 {
-	int i = 0;
 	u32 ir_tdi_data;
 	u32 ir_tdo_data;
 	u32 data = 0;
@@ -919,8 +1415,8 @@ int lcmxo2_4000hc_cpld_erase(void)
 	data = 0x00000000;
 	ast_jtag_tdo_xfer(0, 32, &data);
 
-	if (data != 0x12BC043) {
-		printf("ID Fail : %08x [0x012B5043] \n", data);
+	if (data != cur_dev->dev_id) {
+		printf("ID Fail : %08x [0x%08X] \n", data, cur_dev->dev_id);
 		return -1;
 	}
 #if 0
@@ -1009,42 +1505,27 @@ int lcmxo2_4000hc_cpld_erase(void)
 	ast_jtag_tdo_xfer(0, 32, &data);
 
 #endif
+	//only the CFG flash is erased, SRAM keeps the running design
+	if (background)
+		lattice_enable_x();
+
 	//-----------------------------------------------
 	//    Erase the Flash
 
 	//! Shift in ISC ERASE(0x0E) instruction
 	//SIR 8	TDI  (0E);
-	ir_tdi_data = 0x0E;
-	ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, &ir_tdi_data, &ir_tdo_data);
-
 	//SDR 8	TDI  (04);
 	//RUNTEST IDLE	2 TCK	1.00E+000 SEC;
 	data = 0x04;
-	ast_jtag_tdi_xfer(0, 8, &data);
-	usleep(1000);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, ISC_ERASE);
+	ast_jtag_queue_tdi(0, 8, &data);
 
 	//! Shift in LSC_CHECK_BUSY(0xF0) instruction
 	//SIR 8	TDI  (F0);
-	ir_tdi_data = 0xF0;
-	ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, &ir_tdi_data, &ir_tdo_data);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_CHECK_BUSY);
 
-	//LOOP 350 ;
-	//RUNTEST IDLE	2 TCK	1.00E-002 SEC;
-	//SDR 1	TDI  (0)
-	//		TDO  (0);
-	//ENDLOOP ;
-	printf("LOOP 350  \n");
-	data = 0;
-	for (i = 0; i < 350 ; i++) {
-//		printf("loop count %d \n",i);
-//		ast_jtag_run_test_idle( 0, 0, 2);
-		usleep(2000);
-		ast_jtag_tdo_xfer(0, 1, &data);
-		if (data == 0) {
-			printf("Loop i=%d, exit busy\n", i);
-			break;
-		}
-	}
+	if (lattice_erase_wait() < 0)
+		return -1;
 
 	//! Read the status bit
 
@@ -1085,3 +1566,116 @@ int lcmxo2_4000hc_cpld_erase(void)
 
 }
 
+/*
+ * lcmxo2_4000hc_cpld_read: stream the CFG flash and the USERCODE into w,
+ * VERIFY_ROW_BATCH rows per queue flush and per write. ISC_ENABLE_X keeps
+ * the running design going while the flash is read.
+ */
+int lcmxo2_4000hc_cpld_read(struct jed_writer *w)
+{
+	unsigned int words = cur_dev->dr_bits / 32;
+	unsigned int row, n;
+	u32 data;
+	u32 *buf;
+	int retval = 0;
+
+	buf = malloc(VERIFY_ROW_BATCH * words * sizeof(u32));
+	if (!buf)
+		return -1;
+
+	if (lattice_enable_x() < 0) {
+		free(buf);
+		return -1;
+	}
+
+	//SIR 8	TDI  (46);
+	//SDR 8	TDI  (04);
+	//SIR 8	TDI  (73);
+	if (lattice_read_start(0) < 0)
+		retval = -1;
+
+	printf("Read CONFIG %d \n", w->rows);
+	for (row = 0; (retval == 0) && (row < w->rows); row += n) {
+		n = (w->rows - row > VERIFY_ROW_BATCH) ? VERIFY_ROW_BATCH : w->rows - row;
+		if ((lattice_read_next(n, buf) < 0) || (jed_writer_rows(w, buf, n) < 0))
+			retval = -1;
+	}
+
+	//! Read USERCODE
+	//! Shift in READ USERCODE(0xC0) instruction
+	//SIR 8	TDI  (C0);
+	//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
+	//SDR 32	TDI  (00000000);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, USERCODE);
+	ast_jtag_queue_runtest(2, 1000);
+	data = 0;
+	ast_jtag_queue_tdo(0, 32, &data);
+
+	//! Exit the programming mode
+	//! Shift in ISC DISABLE(0x26) instruction
+	//SIR 8	TDI  (26);
+	//RUNTEST IDLE	2 TCK	1.00E+000 SEC;
+	//SIR 8	TDI  (FF);
+	//RUNTEST IDLE	2 TCK	1.00E-001 SEC;
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, ISC_DISABLE);
+	ast_jtag_queue_runtest(2, 1000);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, BYPASS);
+	ast_jtag_queue_runtest(2, 1000);
+	if (ast_jtag_queue_flush() < 0)
+		retval = -1;
+	w->usercode = data;
+
+	free(buf);
+
+	return retval;
+}
+
+/*
+ * lcmxo2_4000hc_cpld_refresh: LSC_REFRESH, configure the device from its
+ * flash. The running design stops and the I/Os go through configuration,
+ * so this is the step for a moment the host can take it, e.g. power-off,
+ * after a background program.
+ */
+int lcmxo2_4000hc_cpld_refresh(void)
+{
+	u32 status, usercode;
+
+	//! Shift in LSC_REFRESH(0x79) instruction
+	//SIR 8	TDI  (79);
+	//RUNTEST IDLE	2 TCK	1.00E-001 SEC;
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_REFRESH);
+	ast_jtag_queue_runtest(2, cur_dev->timing.refresh);
+
+	//! Shift in LSC_READ_STATUS(0x3C) instruction
+	//SIR 8	TDI  (3C);
+	//RUNTEST IDLE	2 TCK	1.00E-003 SEC;
+	//SDR 32	TDI  (00000000)
+	//		TDO  (00000100)
+	//		MASK (00002100);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, LSC_READ_STATUS);
+	ast_jtag_queue_runtest(2, 1000);
+	status = 0;
+	ast_jtag_queue_tdo(0, 32, &status);
+
+	//! Shift in READ USERCODE(0xC0) instruction
+	//SIR 8	TDI  (C0);
+	//SDR 32	TDI  (00000000);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, USERCODE);
+	ast_jtag_queue_runtest(2, 1000);
+	usercode = 0;
+	ast_jtag_queue_tdo(0, 32, &usercode);
+
+	//! Shift in BYPASS(0xFF) instruction
+	//SIR 8	TDI  (FF);
+	ast_jtag_queue_sir(0, LATTICE_INS_LENGTH, BYPASS);
+	if (ast_jtag_queue_flush() < 0)
+		return -1;
+
+	printf("Refresh status: 0x%08X, USERCODE 0x%08X\n", status, usercode);
+	if (!(status & LATTICE_STATUS_DONE) || (status & LATTICE_STATUS_FAIL)) {
+		printf("Refresh failed, the device did not configure from flash\n");
+		return -1;
+	}
+
+	return 0;
+}
@@ -13,8 +13,20 @@ Please get the JEDEC file format before you read the code
 #include <string.h>
 #include <termios.h>
 #include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
 #include "lattice.h"
 #include "ast-jtag.h"
+#include "jedec.h"
+#include "svf.h"
+#include "jtag-freq.h"
+#include "jed-input.h"
+#include "jed-stream.h"
+#include "jtag-backend.h"
+#include "cpld-stats.h"
+#include "jtag-trace.h"
+#include "cpld-devdb.h"
 
 /*************************************************************************************/
 static void
@@ -29,16 +41,52 @@ usage(FILE *fp, int argc, char **argv)
 			" -u | --getusercode            get cpld usercode\n"
 			" -e | --erase                  Erase cpld\n"
 			" -p | --program                Program cpld and verify\n"
+			" -l | --pipeline               Decode the image in a thread while programming,\n"
+			"                               holding a few rows only; not with -k or -R\n"
+			" -b | --background             Erase/program the flash in transparent mode,\n"
+			"                               the running design carries on until --refresh\n"
+			" -F | --refresh                Configure the cpld from its flash (LSC_REFRESH),\n"
+			"                               activates a background program\n"
 			" -v | --verify                 verifiy cpld image with file\n"
-			" -r | --read                   Read cpld image to file\n"
+			" -r | --read                   Read cpld image to file, JEDEC if it ends in\n"
+			"                               .jed, else a fuse image -p/-v take\n"
+			" -c | --compile                Compile JEDEC file to a fuse image (-o)\n"
+			" -P | --svf                    Play an SVF file\n"
+			" -T | --record FILE            Record every JTAG operation of the session,\n"
+			"                               data and timing, to a binary trace\n"
+			" -Y | --replay FILE            Play a --record trace through -n and report\n"
+			"                               the throughput\n"
+			" -o | --output                 Output file\n"
+			" -k | --skip-identical[=MODE]  Skip program when the device already holds the\n"
+			"                               image, MODE usercode, sample (default) or full;\n"
+			"                               exits with 2 when skipped\n"
+			" -x | --fail-fast              Stop verify at the first mismatching row\n"
+			" -V | --program-verify         With -p/-j, read the rows back in the same\n"
+			"                               session before DONE is set, DONE only when\n"
+			"                               they hold the image\n"
+			" -R | --resume                 With -p/-j, continue an interrupted program\n"
+			"                               from its journal if the device is still as\n"
+			"                               it was left, else erase and start over\n"
+			" -j | --job NODE:IMAGE         Program IMAGE through NODE, may be repeated;\n"
+			"                               jobs run concurrently, one thread per node\n"
+			" -J | --verify-job NODE:IMAGE  Verify IMAGE through NODE, as -j\n"
+			" -t | --target POS             Device on a daisy chain, 0 next to TDO;\n"
+			"                               default the only known CPLD on the chain\n"
+			" -D | --devdb FILE             Add or override devices: part, IDCODE, rows,\n"
+			"                               UFM rows, dr_bits and erase/program times\n"
 			" -d | --debug                  debug mode\n"
 			" -f | --frequency              frequency\n"
+			" -a | --auto-freq[=MAX]        Tune TCK up to MAX Hz (default 50000000) by\n"
+			"                               probing IDCODE and BYPASS, cached per board\n"
 			" -s | --software               SW mode\n"
+			" -S | --stats[=FORMAT[:FILE]]  Report phase times, JTAG traffic, busy polls\n"
+			"                               and the slowest rows per job, FORMAT text\n"
+			"                               (default) or json, to FILE or stdout\n"
 			"",
 			argv[0]);
 }
 
-static const char short_options [] = "dshiuen:p:v:r:f:";
+static const char short_options [] = "dshiuebFln:p:v:r:f:c:o:k::xVRP:T:Y:j:J:t:a::S::D:";
 
 
 
@@ -50,17 +98,98 @@ static const struct option
 	{ "getusercode",	no_argument,		NULL,	'u' },
 	{ "erase",		no_argument,		NULL,	'e' },
 	{ "program",		required_argument,	NULL,	'p' },
+	{ "background",		no_argument,		NULL,	'b' },
+	{ "pipeline",		no_argument,		NULL,	'l' },
+	{ "refresh",		no_argument,		NULL,	'F' },
 	{ "verify",		required_argument,	NULL,	'v' },
 	{ "read",		required_argument,	NULL,	'r' },
 	{ "debug",		no_argument,		NULL,	'd' },
+	{ "devdb",		required_argument,	NULL,	'D' },
 	{ "software",		no_argument,		NULL,	's' },
 	{ "fequency",		required_argument,	NULL,	'f' },
+	{ "compile",		required_argument,	NULL,	'c' },
+	{ "output",		required_argument,	NULL,	'o' },
+	{ "skip-identical",	optional_argument,	NULL,	'k' },
+	{ "fail-fast",		no_argument,		NULL,	'x' },
+	{ "program-verify",	no_argument,		NULL,	'V' },
+	{ "resume",		no_argument,		NULL,	'R' },
+	{ "svf",		required_argument,	NULL,	'P' },
+	{ "record",		required_argument,	NULL,	'T' },
+	{ "replay",		required_argument,	NULL,	'Y' },
+	{ "job",		required_argument,	NULL,	'j' },
+	{ "verify-job",		required_argument,	NULL,	'J' },
+	{ "target",		required_argument,	NULL,	't' },
+	{ "auto-freq",		optional_argument,	NULL,	'a' },
+	{ "stats",		optional_argument,	NULL,	'S' },
 	{ 0, 0, 0, 0 }
 };
 
-struct cpld_dev_info *cur_dev;
+/* device and node of the calling thread, jobs run one thread per controller */
+__thread struct cpld_dev_info *cur_dev;
+__thread const char *cur_node;
 unsigned int mode = JTAG_XFER_HW_MODE;
+unsigned int freq = 0;
+unsigned int auto_freq = 0;
 int debug = 0;
+int skip_identical = CPLD_SKIP_NONE;
+int fail_fast = 0;
+int program_verify = 0;
+int resume = 0;
+int background = 0;
+int pipeline = 0;
+/* SIGINT/SIGTERM, program stops at the next row and keeps its journal */
+volatile sig_atomic_t cpld_stop = 0;
+int chain_target = -1;
+/* --stats */
+int stats_format = 0;
+const char *stats_file = NULL;
+/* --record */
+const char *record_file = NULL;
+
+/* exit code when -k found the image already programmed */
+#define EXIT_UP_TO_DATE		2
+
+#define CPLD_JOBS_MAX		16
+
+#define STATS_TEXT		1
+#define STATS_JSON		2
+
+enum cpld_op {
+	CPLD_OP_NONE,
+	CPLD_OP_ERASE,
+	CPLD_OP_IDCODE,
+	CPLD_OP_PROGRAM,
+	CPLD_OP_VERIFY,
+	CPLD_OP_READ,
+	CPLD_OP_REFRESH,
+};
+
+/**
+ * struct cpld_job - one controller and what to do with its device:
+ *
+ * @node: JTAG device node
+ * @image: JEDEC file or fuse image for program/verify, output for read
+ * @op: enum cpld_op
+ * @dev: device entry, a copy so jobs never share row_num
+ * @dev_id: IDCODE read from the device
+ * @status: 0, EXIT_UP_TO_DATE or -1
+ * @msecs: time taken
+ * @stats: phase times, busy polls and slowest rows
+ * @jstats: JTAG traffic
+ * @thread: job thread
+ */
+struct cpld_job {
+	char			node[100];
+	char			image[100];
+	int			op;
+	struct cpld_dev_info	dev;
+	unsigned int		dev_id;
+	int			status;
+	unsigned long		msecs;
+	struct cpld_stats	stats;
+	struct jtag_stats	jstats;
+	pthread_t		thread;
+};
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -103,18 +232,481 @@ int lattice_get_id_pub(unsigned int *id)
 	return 0;
 }
 
+/*
+ * jed_compile: turn a JEDEC file into a pre-compiled fuse image for the
+ * device named in its "DEVICE NAME" note.
+ */
+static int jed_compile(char *in_name, char *out_name)
+{
+	struct jed_file jed;
+	struct cpld_dev_info *dev;
+	int retval;
+
+	if (!strcmp(out_name, "")) {
+		printf("No output file name!\n");
+		return -1;
+	}
+
+	if (jed_file_load(in_name, &jed) < 0)
+		return -1;
+
+	dev = cpld_dev_lookup_part(jed.device);
+	if (!dev) {
+		printf("AST LATTICE Device - UnKnow : %s \n", jed.device);
+		jed_file_free(&jed);
+		return -1;
+	}
+
+	retval = jed_image_write(out_name, &jed, dev->dev_id,
+				 jed.cfg_bits / dev->dr_bits, dev->dr_bits);
+	if (retval == 0)
+		printf("Compile : %s, %d rows, usercode 0x%08X, CRC32 0x%08X -> %s\n",
+		       dev->name, jed.cfg_bits / dev->dr_bits, jed.usercode,
+		       jed.crc32, out_name);
+
+	jed_file_free(&jed);
+
+	return retval;
+}
+
 /*************************************************************************************/
-int main(int argc, char *argv[])
+/*				JOBS						*/
+
+/* cpld_jtag_open: open node and bring the controller up in mode/freq */
+static int cpld_jtag_open(char *node)
 {
+	unsigned int jtag_freq;
+
+	if (ast_jtag_open(node))
+		return -1;
+
+	// set jtag mode
+	if (ast_set_mode(mode) < 0) {
+		perror("Jtag setmode error !! \n");
+		goto err;
+	}
+	//show current ast jtag configuration
+	jtag_freq = ast_get_jtag_freq();
+
+	if (jtag_freq == 0) {
+		perror("Jtag freq error !! \n");
+		goto err;
+	}
+
+	if (freq) {
+		ast_set_jtag_freq(freq);
+		printf("Mode : %s , JTAG Set Freq %d", mode ? "HW" : "SW", freq);
+	} else {
+		printf("Mode : %s , JTAG Freq %d", mode ? "HW" : "SW", jtag_freq);
+	}
+
+	if (debug) printf(", debug mode \n");
+	else printf("\n");
+
+	if (record_file && (jtag_trace_open(record_file, node, freq ? freq : jtag_freq) < 0))
+		goto err;
+
+	//ast_jtag_run_test_idle(1, 0, 0);
+	usleep(5000);
+
+	return 0;
+err:
+	ast_jtag_close();
+	return -1;
+}
+
+/*
+ * cpld_chain_select: scan the chain and pad every following scan so only
+ * the target device is addressed, the others sitting in BYPASS. The IR
+ * lengths come from lattice_device_list, so every device on a chain of
+ * more than one must be known.
+ */
+static int cpld_chain_select(int target)
+{
+	u32 idcode[JTAG_CHAIN_MAX];
+	struct cpld_dev_info *dev[JTAG_CHAIN_MAX];
+	struct jtag_chain chain;
+	int i, n, known = 0;
+
+	//without -t a chain that cannot be scanned is taken as one device,
+	//as before chain support
+	n = ast_jtag_chain_scan(idcode, JTAG_CHAIN_MAX);
+	if ((n <= 0) && (target < 0)) {
+		printf("JTAG chain: scan failed, assuming a single device\n");
+		return 0;
+	}
+	if (n <= 0) {
+		printf("JTAG chain: no device found\n");
+		return -1;
+	}
+	if ((n == 1) && (target <= 0))
+		return 0;
+
+	printf("JTAG chain: %d devices\n", n);
+	for (i = 0; i < n; i++) {
+		dev[i] = cpld_dev_lookup(idcode[i]);
+		printf("  %d: IDCODE 0x%08X %s\n", i, idcode[i],
+		       dev[i] ? dev[i]->part : "unknown");
+		if (dev[i]) {
+			known++;
+			if (target < 0)
+				target = i;
+		}
+	}
+
+	if ((target < 0) || (target >= n)) {
+		printf("JTAG chain: no target device\n");
+		return -1;
+	}
+	if ((chain_target < 0) && (known > 1)) {
+		printf("JTAG chain: %d CPLDs, pick one with -t\n", known);
+		return -1;
+	}
+
+	memset(&chain, 0, sizeof(chain));
+	for (i = 0; i < n; i++) {
+		if (i == target)
+			continue;
+		if (!dev[i]) {
+			printf("JTAG chain: IR length of device %d unknown\n", i);
+			return -1;
+		}
+		if (i < target) {
+			chain.hir += dev[i]->ir_bits;
+			chain.hdr++;
+		} else {
+			chain.tir += dev[i]->ir_bits;
+			chain.tdr++;
+		}
+	}
+	printf("JTAG chain: target %d, %u+%u IR / %u+%u DR padding bits\n",
+	       target, chain.hir, chain.tir, chain.hdr, chain.tdr);
+	ast_jtag_set_chain(&chain);
+
+	return 0;
+}
+
+/* cpld_job_run: identify the device on job->node and run job->op on it */
+static int cpld_job_run(struct cpld_job *job)
+{
+	struct cpld_dev_info *dev;
+	struct jed_file jed;
+	struct jed_stream stream;
+	struct jed_writer w;
+	int ret = 0;
+
+	cpld_stats_phase(CPLD_PHASE_OPEN);
+	if (cpld_jtag_open(job->node) < 0)
+		return -1;
+	cur_node = job->node;
+
+	if (cpld_chain_select(chain_target) < 0) {
+		ast_jtag_close();
+		return -1;
+	}
+
+#if 0
+	lattice_get_id(&job->dev_id);
+#else
+	lattice_get_id_pub(&job->dev_id);
+#endif
+	dev = cpld_dev_lookup(job->dev_id);
+	if (!dev) {
+		printf("AST LATTICE Device - UnKnow : %x \n", job->dev_id);
+		cur_dev = NULL;
+		ast_jtag_close();
+		return -1;
+	}
+	job->dev = *dev;
+	cur_dev = &job->dev;
+	printf("AST LATTICE Device : %s \n", cur_dev->name);
+
+	cpld_stats_phase(CPLD_PHASE_FREQ);
+	if (auto_freq && (jtag_auto_freq(job->node, job->dev_id, auto_freq) < 0)) {
+		ast_jtag_close();
+		return -1;
+	}
+
+	//a pipelined image is checked here, then decoded again while programming
+	cpld_stats_phase(CPLD_PHASE_PARSE);
+	//-k and -R compare the device with the whole fuse map
+	if ((job->op == CPLD_OP_PROGRAM) && pipeline && !skip_identical && !resume) {
+		if (jed_stream_open(&stream, job->image, &jed, cur_dev->dr_bits) < 0) {
+			ast_jtag_close();
+			return -1;
+		}
+		if (jed.dev_id && (jed.dev_id != cur_dev->dev_id)) {
+			printf("Image is for IDCODE 0x%08X, device is 0x%08X\n",
+			       jed.dev_id, cur_dev->dev_id);
+			jed_stream_close(&stream);
+			jed_file_free(&jed);
+			ast_jtag_close();
+			return -1;
+		}
+	} else if ((job->op == CPLD_OP_PROGRAM) || (job->op == CPLD_OP_VERIFY)) {
+		if (jed_file_load(job->image, &jed) < 0) {
+			ast_jtag_close();
+			return -1;
+		}
+		if (jed.dev_id && (jed.dev_id != cur_dev->dev_id)) {
+			printf("Image is for IDCODE 0x%08X, device is 0x%08X\n",
+			       jed.dev_id, cur_dev->dev_id);
+			jed_file_free(&jed);
+			ast_jtag_close();
+			return -1;
+		}
+	}
+
+	if (debug) printf("function dispatch op %d\n", job->op);
+
+	switch (job->op) {
+	case CPLD_OP_ERASE:
+		cpld_stats_phase(CPLD_PHASE_ERASE);
+		printf("Starting to Erase Device . . . ");
+		if (cur_dev->cpld_erase() < 0)
+			ret = -1;
+		break;
+	case CPLD_OP_IDCODE:
+		printf("CPLD IDCODE is 0x%x\n", job->dev_id);
+		break;
+	case CPLD_OP_PROGRAM:
+		printf("Program : JEDEC file %s\n", job->image);
+		//the -k and -R checks, the program moves on to erase and rows
+		cpld_stats_phase(CPLD_PHASE_CHECK);
+		ret = cur_dev->cpld_program(&jed);
+		if (ret == CPLD_UP_TO_DATE)
+			ret = EXIT_UP_TO_DATE;
+		else if (ret < 0)
+			ret = -1;
+		break;
+	case CPLD_OP_VERIFY:
+		printf("Verify : JEDEC file %s\n", job->image);
+		cpld_stats_phase(CPLD_PHASE_VERIFY);
+		if (cur_dev->cpld_verify(&jed) < 0)
+			ret = -1;
+		break;
+	case CPLD_OP_READ:
+		printf("Read : %s, %d rows\n", job->image, cur_dev->row_num);
+		cpld_stats_phase(CPLD_PHASE_READ);
+		if (jed_writer_open(&w, job->image, cur_dev->part, job->dev_id,
+				    cur_dev->row_num, cur_dev->dr_bits) < 0) {
+			ret = -1;
+			break;
+		}
+		ret = cur_dev->cpld_read(&w);
+		if (jed_writer_close(&w, ret == 0) < 0)
+			ret = -1;
+		break;
+	case CPLD_OP_REFRESH:
+		printf("Refresh : configure from flash\n");
+		cpld_stats_phase(CPLD_PHASE_REFRESH);
+		if (cur_dev->cpld_refresh() < 0)
+			ret = -1;
+		break;
+	}
+
+//	system("echo 890 > /sys/class/gpio/unexport");
+	cpld_stats_phase(CPLD_PHASE_NONE);
+	if ((job->op == CPLD_OP_PROGRAM) || (job->op == CPLD_OP_VERIFY)) {
+		if (jed.stream)
+			jed_stream_close(jed.stream);
+		jed_file_free(&jed);
+	}
+
+	ast_jtag_close();
+
+	return ret;
+}
+
+/* cpld_job_exec: run the job in the calling thread, keep its time and stats */
+static void cpld_job_exec(struct cpld_job *job)
+{
+	struct timespec start, end;
+
+	cpld_stats_reset();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	job->status = cpld_job_run(job);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->msecs = (end.tv_sec - start.tv_sec) * 1000 +
+		     (end.tv_nsec - start.tv_nsec) / 1000000;
+
+	cpld_stats_phase(CPLD_PHASE_NONE);
+	job->stats = cpld_stats;
+	job->jstats = jtag_stats;
+}
+
+static void *cpld_job_thread(void *arg)
+{
+	cpld_job_exec(arg);
+
+	return NULL;
+}
+
+/* cpld_job_parse: NODE:IMAGE, split at the last ':' so sim:<file> nodes work */
+static int cpld_job_parse(struct cpld_job *job, const char *arg, int op)
+{
+	const char *sep = strrchr(arg, ':');
+
+	if (!sep || sep == arg || !sep[1] ||
+	    (size_t) (sep - arg) >= sizeof(job->node) || strlen(sep + 1) >= sizeof(job->image)) {
+		printf("Bad job '%s', need NODE:IMAGE\n", arg);
+		return -1;
+	}
+
+	memset(job, 0, sizeof(*job));
+	memcpy(job->node, arg, sep - arg);
+	strcpy(job->image, sep + 1);
+	job->op = op;
+
+	return 0;
+}
+
+/*
+ * cpld_jobs_run: one thread per job, each on its own controller, so the
+ * update takes as long as the slowest device. Returns -1 when any job
+ * failed, EXIT_UP_TO_DATE when every device was skipped, 0 otherwise.
+ */
+static int cpld_jobs_run(struct cpld_job *jobs, int njobs)
+{
+	int started[CPLD_JOBS_MAX];
+	int i, failed = 0, skipped = 0;
+
+	for (i = 0; i < njobs; i++) {
+		started[i] = !pthread_create(&jobs[i].thread, NULL, cpld_job_thread, &jobs[i]);
+		if (!started[i]) {
+			printf("%s: cannot start job thread\n", jobs[i].node);
+			jobs[i].status = -1;
+		}
+	}
+
+	for (i = 0; i < njobs; i++) {
+		if (started[i])
+			pthread_join(jobs[i].thread, NULL);
+	}
+
+	printf("\nJob summary:\n");
+	for (i = 0; i < njobs; i++) {
+		printf("  %-24s %-8s %-14s %s %s, %lu.%03lu s\n", jobs[i].node,
+		       jobs[i].op == CPLD_OP_VERIFY ? "verify" : "program",
+		       jobs[i].dev.part ? jobs[i].dev.part : "unknown",
+		       jobs[i].image,
+		       jobs[i].status == 0 ? "OK" :
+		       jobs[i].status == EXIT_UP_TO_DATE ? "UP-TO-DATE" : "FAILED",
+		       jobs[i].msecs / 1000, jobs[i].msecs % 1000);
+		if (jobs[i].status == EXIT_UP_TO_DATE)
+			skipped++;
+		else if (jobs[i].status)
+			failed++;
+	}
+
+	if (failed)
+		return -1;
+	if (skipped == njobs)
+		return EXIT_UP_TO_DATE;
+	return 0;
+}
+
+static const char *cpld_op_names[] = {
+	[CPLD_OP_NONE] = "none",
+	[CPLD_OP_ERASE] = "erase",
+	[CPLD_OP_IDCODE] = "idcode",
+	[CPLD_OP_PROGRAM] = "program",
+	[CPLD_OP_VERIFY] = "verify",
+	[CPLD_OP_READ] = "read",
+	[CPLD_OP_REFRESH] = "refresh",
+};
+
+static const char *cpld_status_name(int status)
+{
+	if (status == 0)
+		return "ok";
+	if (status == EXIT_UP_TO_DATE)
+		return "up-to-date";
+	return "failed";
+}
+
+/*
+ * cpld_stats_report: --stats of every job, a text block per job or one
+ * JSON document {"jobs": [...]} for the rollout tooling.
+ */
+static void cpld_stats_report(const struct cpld_job *jobs, int njobs)
+{
+	FILE *fp = stdout;
 	int i;
+
+	if (stats_file) {
+		fp = fopen(stats_file, "w");
+		if (!fp) {
+			fprintf(stderr, "Cannot open '%s': %d, %s\n", stats_file, errno, strerror(errno));
+			return;
+		}
+	}
+
+	if (stats_format == STATS_JSON)
+		fprintf(fp, "{\"jobs\": [");
+	else
+		fprintf(fp, "\nStatistics:\n");
+
+	for (i = 0; i < njobs; i++) {
+		if (stats_format == STATS_JSON) {
+			fprintf(fp, "%s\n{\"node\": ", i ? "," : "");
+			cpld_json_string(fp, jobs[i].node);
+			fprintf(fp, ", \"op\": \"%s\", \"device\": ", cpld_op_names[jobs[i].op]);
+			cpld_json_string(fp, jobs[i].dev.part ? jobs[i].dev.part : "unknown");
+			fprintf(fp, ", \"idcode\": %u, \"image\": ", jobs[i].dev_id);
+			cpld_json_string(fp, jobs[i].image);
+			fprintf(fp, ", \"status\": \"%s\", \"msecs\": %lu, \"stats\": ",
+				cpld_status_name(jobs[i].status), jobs[i].msecs);
+			cpld_stats_json(fp, &jobs[i].stats, &jobs[i].jstats);
+			fprintf(fp, "}");
+		} else {
+			fprintf(fp, "%s %s %s, %lu.%03lu s\n", jobs[i].node,
+				cpld_op_names[jobs[i].op], cpld_status_name(jobs[i].status),
+				jobs[i].msecs / 1000, jobs[i].msecs % 1000);
+			cpld_stats_text(fp, &jobs[i].stats, &jobs[i].jstats);
+		}
+	}
+
+	if (stats_format == STATS_JSON)
+		fprintf(fp, "\n]}\n");
+
+	if (fp != stdout)
+		fclose(fp);
+	else
+		fflush(fp);
+}
+
+static void cpld_stop_handler(int sig)
+{
+	(void) sig;
+	cpld_stop = 1;
+}
+
+/* the first signal asks to stop at a checkpoint, a second one kills */
+static void cpld_catch_stop(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = cpld_stop_handler;
+	sa.sa_flags = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+/*************************************************************************************/
+int main(int argc, char *argv[])
+{
 	char option;
 	char in_name[100] = "", out_name[100] = "";
 	char dev_name[100] = "/dev/jtag0";
-	FILE *fp_in;
-	int erase = 0, program = 0, verify = 0, gidcode = 0;
-	unsigned int freq = 0;
-	unsigned int jtag_freq = 0;
-	unsigned int dev_id = 0x0;
+	int erase = 0, program = 0, verify = 0, gidcode = 0, compile = 0, svf = 0, read = 0;
+	int refresh = 0, replay = 0;
+	const char *devdb = NULL;
+	int ret = 0;
+	struct cpld_job jobs[CPLD_JOBS_MAX], job;
+	int njobs = 0;
 
 	while ((option = getopt_long(argc, argv, short_options, long_options, NULL)) != (char) -1) {
 //		printf("option is c %c\n", option);
@@ -137,6 +729,15 @@ int main(int argc, char *argv[])
 		case 'e':
 			erase = 1;
 			break;
+		case 'b':
+			background = 1;
+			break;
+		case 'l':
+			pipeline = 1;
+			break;
+		case 'F':
+			refresh = 1;
+			break;
 		case 'p':
 			program = 1;
 			strcpy(in_name, optarg);
@@ -156,7 +757,7 @@ int main(int argc, char *argv[])
 			}
 			break;
 		case 'r':
-			//read = 1;
+			read = 1;
 			strcpy(out_name, optarg);
 			if (!strcmp(out_name, "")) {
 				printf("No out file name!\n");
@@ -164,10 +765,108 @@ int main(int argc, char *argv[])
 				exit(EXIT_FAILURE);
 			}
 			break;
+		case 'c':
+			compile = 1;
+			strcpy(in_name, optarg);
+			if (!strcmp(in_name, "")) {
+				printf("No input file name!\n");
+				usage(stdout, argc, argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'o':
+			strcpy(out_name, optarg);
+			break;
+		case 'P':
+			svf = 1;
+			strcpy(in_name, optarg);
+			if (!strcmp(in_name, "")) {
+				printf("No input file name!\n");
+				usage(stdout, argc, argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'T':
+			record_file = optarg;
+			break;
+		case 'Y':
+			replay = 1;
+			strcpy(in_name, optarg);
+			if (!strcmp(in_name, "")) {
+				printf("No input file name!\n");
+				usage(stdout, argc, argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'k':
+			if (!optarg || !strcmp(optarg, "sample")) {
+				skip_identical = CPLD_SKIP_SAMPLE;
+			} else if (!strcmp(optarg, "usercode")) {
+				skip_identical = CPLD_SKIP_USERCODE;
+			} else if (!strcmp(optarg, "full")) {
+				skip_identical = CPLD_SKIP_FULL;
+			} else {
+				usage(stdout, argc, argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'x':
+			fail_fast = 1;
+			break;
+		case 'V':
+			program_verify = 1;
+			break;
+		case 'R':
+			resume = 1;
+			break;
+		case 't':
+			chain_target = atoi(optarg);
+			break;
+		case 'a':
+			auto_freq = optarg ? strtoul(optarg, NULL, 0) : JTAG_FREQ_MAX;
+			if (!auto_freq) {
+				usage(stdout, argc, argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'S':
+			if (!optarg || !strncmp(optarg, "text", 4)) {
+				stats_format = STATS_TEXT;
+			} else if (!strncmp(optarg, "json", 4)) {
+				stats_format = STATS_JSON;
+			} else {
+				usage(stdout, argc, argv);
+				exit(EXIT_FAILURE);
+			}
+			//FORMAT:FILE
+			if (optarg && optarg[4]) {
+				if ((optarg[4] != ':') || !optarg[5]) {
+					usage(stdout, argc, argv);
+					exit(EXIT_FAILURE);
+				}
+				stats_file = optarg + 5;
+			}
+			break;
+		case 'j':
+		case 'J':
+			if (njobs == CPLD_JOBS_MAX) {
+				printf("Too many jobs, at most %d\n", CPLD_JOBS_MAX);
+				exit(EXIT_FAILURE);
+			}
+			if (cpld_job_parse(&jobs[njobs], optarg,
+					   option == 'J' ? CPLD_OP_VERIFY : CPLD_OP_PROGRAM) < 0) {
+				usage(stdout, argc, argv);
+				exit(EXIT_FAILURE);
+			}
+			njobs++;
+			break;
 		case 'd':
 			debug = 1;
 //				printf("debug is %d\n",debug);
 			break;
+		case 'D':
+			devdb = optarg;
+			break;
 		case 'f':
 			freq = atol(optarg);
 			printf("frequency %d\n", freq);
@@ -185,91 +884,70 @@ int main(int argc, char *argv[])
 //	system("echo 890 > /sys/class/gpio/export");
 //	system("echo out > /sys/class/gpio/gpio890/direction");
 //	system("echo 1 > /sys/class/gpio/gpio890/value");
-/////////////////////////////////////////////////////////////////////
-	if (ast_jtag_open(dev_name))
-		exit(1);
+	if (devdb && (cpld_devdb_load(devdb) < 0))
+		exit(EXIT_FAILURE);
 
-	// set jtag mode
-	if (ast_set_mode(mode) < 0) {
-	perror("Jtag setmode error !! \n");
-	exit(1);
-	}
-	//show current ast jtag configuration
-	jtag_freq = ast_get_jtag_freq();
+	if (compile)
+		exit(jed_compile(in_name, out_name) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
 
-	if (jtag_freq == 0) {
-		perror("Jtag freq error !! \n");
-		exit(1);
-	}
+	if (njobs || program)
+		cpld_catch_stop();
 
-	if (freq) {
-		ast_set_jtag_freq(freq);
-		printf("Mode : %s , JTAG Set Freq %d", mode ? "HW" : "SW", freq);
-	} else {
-		printf("Mode : %s , JTAG Freq %d", mode ? "HW" : "SW", jtag_freq);
+	//one trace file, one controller
+	if (njobs && record_file) {
+		printf("--record takes a single -n node, not -j/-J jobs\n");
+		exit(EXIT_FAILURE);
 	}
 
-	if (debug) printf(", debug mode \n");
-	else printf("\n");
-
-	//ast_jtag_run_test_idle(1, 0, 0);
-	usleep(5000);
-
-#if 0
-	lattice_get_id(&dev_id);
-#else
-	lattice_get_id_pub(&dev_id);
-#endif
-	for (i = 0; i < ARRAY_SIZE(lattice_device_list); i++) {
-		if (dev_id == lattice_device_list[i].dev_id)
-			break;
+	if (njobs) {
+		ret = cpld_jobs_run(jobs, njobs);
+		if (stats_format)
+			cpld_stats_report(jobs, njobs);
+		return ret;
 	}
 
-	if (i == ARRAY_SIZE(lattice_device_list)) {
-		printf("AST LATTICE Device - UnKnow : %x \n", dev_id);
-		cur_dev = NULL;
-		goto err;
-	} else {
-		cur_dev = &lattice_device_list[i];
-		printf("AST LATTICE Device : %s \n", cur_dev->name);
+/////////////////////////////////////////////////////////////////////
+	//an SVF file brings its own flow, no device lookup
+	if (svf) {
+		if (cpld_jtag_open(dev_name) < 0)
+			exit(1);
+		ret = svf_play(in_name);
+		ast_jtag_close();
+		return ret;
 	}
 
-	if ((program) || (verify)) {
-		fp_in = fopen(in_name, "rb");
-		if (!fp_in) {
-			fprintf(stderr, "Cannot open '%s': %d, %s\n", in_name, errno, strerror(errno));
-			goto out;
-		}
+	if (replay) {
+		if (cpld_jtag_open(dev_name) < 0)
+			exit(1);
+		ret = jtag_trace_replay(in_name);
+		ast_jtag_close();
+		return ret;
 	}
 
-	if (debug) printf("function dispatch erase %d, program %d, verify %d\n", erase, program, verify);
+	memset(&job, 0, sizeof(job));
+	strcpy(job.node, dev_name);
+	strcpy(job.image, in_name);
+	if (erase)
+		job.op = CPLD_OP_ERASE;
+	else if (gidcode)
+		job.op = CPLD_OP_IDCODE;
+	else if (program)
+		job.op = CPLD_OP_PROGRAM;
+	else if (verify)
+		job.op = CPLD_OP_VERIFY;
+	else if (read)
+		job.op = CPLD_OP_READ;
+	else if (refresh)
+		job.op = CPLD_OP_REFRESH;
+	if (read)
+		strcpy(job.image, out_name);
 
-	if (erase) {
-		printf("Starting to Erase Device . . . ");
-		cur_dev->cpld_erase();
-	} else if (gidcode) {
-		printf("CPLD IDCODE is 0x%x\n", dev_id);
-	} else if (program) {
-		printf("Program : JEDEC file %s\n", in_name);
-//		jed_ami(fp_in);
-		cur_dev->cpld_program(fp_in);
-	} else if (verify) {
-		printf("Verify : JEDEC file %s\n", in_name);
-		cur_dev->cpld_verify(fp_in);
-	} else {
+	cpld_job_exec(&job);
+	ret = job.status;
+	if (stats_format)
+		cpld_stats_report(&job, 1);
+	if (job.op == CPLD_OP_NONE && cur_dev)
 		usage(stdout, argc, argv);
-	}
-
-out:
-//	system("echo 890 > /sys/class/gpio/unexport");
-	if ((program) || (verify))
-		fclose(fp_in);
-
-	ast_jtag_close();
 
-	return 0;
-err:
-//	system("echo 890 > /sys/class/gpio/unexport");
-	ast_jtag_close();
-	return -1;
+	return ret;
 }
@@ -0,0 +1,693 @@
+/*
+Serial Vector Format player, see the SVF specification (ASSET InterTech)
+*/
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "ast-jtag.h"
+#include "svf.h"
+
+extern int debug;
+
+#define SVF_WORDS(len)	(((len) + 31) / 32)
+
+static const struct {
+	const char	*name;
+	unsigned char	state;
+} svf_states[] = {
+	{ "RESET",	JTAG_STATE_TLRESET },
+	{ "IDLE",	JTAG_STATE_IDLE },
+	{ "DRSELECT",	JTAG_STATE_SELECTDR },
+	{ "DRCAPTURE",	JTAG_STATE_CAPTUREDR },
+	{ "DRSHIFT",	JTAG_STATE_SHIFTDR },
+	{ "DREXIT1",	JTAG_STATE_EXIT1DR },
+	{ "DRPAUSE",	JTAG_STATE_PAUSEDR },
+	{ "DREXIT2",	JTAG_STATE_EXIT2DR },
+	{ "DRUPDATE",	JTAG_STATE_UPDATEDR },
+	{ "IRSELECT",	JTAG_STATE_SELECTIR },
+	{ "IRCAPTURE",	JTAG_STATE_CAPTUREIR },
+	{ "IRSHIFT",	JTAG_STATE_SHIFTIR },
+	{ "IREXIT1",	JTAG_STATE_EXIT1IR },
+	{ "IRPAUSE",	JTAG_STATE_PAUSEIR },
+	{ "IREXIT2",	JTAG_STATE_EXIT2IR },
+	{ "IRUPDATE",	JTAG_STATE_UPDATEIR },
+};
+
+/*************************************************************************************/
+
+static int svf_state(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(svf_states) / sizeof(svf_states[0]); i++) {
+		if (!strcmp(name, svf_states[i].name))
+			return svf_states[i].state;
+	}
+
+	return -1;
+}
+
+/* bit n of buf */
+static inline u32 svf_bit(const u32 *buf, unsigned int n)
+{
+	return (buf[n / 32] >> (n % 32)) & 1;
+}
+
+/* copy len bits of src to dst from bit pos on */
+static void svf_bits_copy(u32 *dst, unsigned int pos, const u32 *src, unsigned int len)
+{
+	unsigned int i;
+
+	if ((pos % 32) == 0) {
+		memcpy(&dst[pos / 32], src, SVF_WORDS(len) * sizeof(u32));
+		return;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (svf_bit(src, i))
+			dst[(pos + i) / 32] |= 1u << ((pos + i) % 32);
+	}
+}
+
+/*
+ * svf_read_stmt: copy the next statement to pl->stmt without the ';'.
+ * Comments ('!' and '//') and line breaks are dropped, white space inside
+ * parentheses too, and everything is upper cased. Returns 0 at the end of
+ * the file.
+ */
+static int svf_read_stmt(struct svf_player *pl)
+{
+	size_t len = 0;
+	int paren = 0, comment = 0;
+	char c;
+
+	while (pl->pos < pl->size) {
+		c = pl->map[pl->pos++];
+
+		if (c == '\n') {
+			pl->line++;
+			comment = 0;
+		}
+		if (comment)
+			continue;
+		if ((c == '!') || ((c == '/') && (pl->pos < pl->size) && (pl->map[pl->pos] == '/'))) {
+			comment = 1;
+			continue;
+		}
+		if (!paren && (c == ';')) {
+			pl->stmt[len] = '\0';
+			return 1;
+		}
+
+		if (len + 4 > pl->stmt_max) {
+			char *stmt = realloc(pl->stmt, pl->stmt_max * 2);
+
+			if (!stmt) {
+				printf("Out of memory for SVF statement at line %u\n", pl->line);
+				return -1;
+			}
+			pl->stmt = stmt;
+			pl->stmt_max *= 2;
+		}
+
+		if (c == '(') {
+			paren = 1;
+			pl->stmt[len++] = ' ';
+			pl->stmt[len++] = '(';
+		} else if (c == ')') {
+			paren = 0;
+			pl->stmt[len++] = ' ';
+		} else if (isspace((unsigned char) c)) {
+			if (!paren && len && (pl->stmt[len - 1] != ' '))
+				pl->stmt[len++] = ' ';
+		} else {
+			pl->stmt[len++] = toupper((unsigned char) c);
+		}
+	}
+
+	//trailing text without ';'
+	while (len && (pl->stmt[len - 1] == ' '))
+		len--;
+	if (len) {
+		printf("SVF line %u: statement without ';'\n", pl->line);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* next space separated token of *s, NULL at the end */
+static char *svf_token(char **s)
+{
+	char *tok;
+
+	while (**s == ' ')
+		(*s)++;
+	if (**s == '\0')
+		return NULL;
+
+	tok = *s;
+	while (**s && (**s != ' '))
+		(*s)++;
+	if (**s)
+		*(*s)++ = '\0';
+
+	return tok;
+}
+
+/*
+ * svf_hex: hex string (MSB first) to len bits, first bit in bit 0 of
+ * bits[0]. Digits beyond len bits must be zero.
+ */
+static int svf_hex(const char *hex, unsigned int len, u32 *bits)
+{
+	size_t n = strlen(hex);
+	unsigned int pos = 0;
+	u32 d;
+	char c;
+
+	memset(bits, 0, SVF_WORDS(len) * sizeof(u32));
+
+	while (n--) {
+		c = hex[n];
+		if ((c >= '0') && (c <= '9'))
+			d = c - '0';
+		else if ((c >= 'A') && (c <= 'F'))
+			d = c - 'A' + 10;
+		else
+			return -1;
+
+		if (pos >= len) {
+			if (d)
+				return -1;
+			continue;
+		}
+		if (pos + 4 > len)
+			d &= (1u << (len - pos)) - 1;
+		bits[pos / 32] |= d << (pos % 32);
+		pos += 4;
+	}
+
+	return 0;
+}
+
+static void svf_vec_free(struct svf_vec *v)
+{
+	free(v->tdi);
+	free(v->tdo);
+	free(v->mask);
+	memset(v, 0, sizeof(*v));
+}
+
+/*
+ * svf_vec_parse: parse "<len> TDI (..) TDO (..) MASK (..) SMASK (..)".
+ * TDI and MASK carry over to the next scan of the same length, TDO does not.
+ */
+static int svf_vec_parse(struct svf_player *pl, struct svf_vec *v, char *args)
+{
+	char *tok, *val, *end;
+	unsigned long len;
+	size_t size;
+	u32 **dst;
+
+	tok = svf_token(&args);
+	if (!tok)
+		return -1;
+	len = strtoul(tok, &end, 10);
+	if (*end != '\0')
+		return -1;
+
+	if ((len != v->len) || !v->tdi) {
+		svf_vec_free(v);
+		v->len = len;
+		size = (SVF_WORDS(len) + 1) * sizeof(u32);
+		v->tdi = calloc(1, size);
+		v->tdo = calloc(1, size);
+		v->mask = malloc(size);
+		if (!v->tdi || !v->tdo || !v->mask) {
+			printf("Out of memory for SVF scan of %lu bits\n", len);
+			return -1;
+		}
+		memset(v->mask, 0xff, size);
+	}
+	v->has_tdo = 0;
+
+	while ((tok = svf_token(&args))) {
+		val = svf_token(&args);
+		if (!val || (val[0] != '('))
+			return -1;
+
+		if (!strcmp(tok, "TDI")) {
+			dst = &v->tdi;
+		} else if (!strcmp(tok, "TDO")) {
+			dst = &v->tdo;
+			v->has_tdo = 1;
+		} else if (!strcmp(tok, "MASK")) {
+			dst = &v->mask;
+		} else if (!strcmp(tok, "SMASK")) {
+			//TDI is always driven
+			continue;
+		} else {
+			return -1;
+		}
+
+		if (svf_hex(val + 1, len, *dst) < 0) {
+			printf("SVF line %u: bad %s data\n", pl->line, tok);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * svf_flush: run the queued scans and compare the pending TDO checks.
+ * A mismatch inside a LOOP only marks the iteration as failed.
+ */
+static int svf_flush(struct svf_player *pl)
+{
+	struct svf_check *ck;
+	unsigned int b;
+	int i, retval = 0;
+
+	pl->flushes++;
+	if (ast_jtag_queue_flush() < 0)
+		retval = -1;
+
+	for (i = 0; i < pl->nchecks; i++) {
+		ck = &pl->check[i];
+		if ((retval == 0) && ck->len) {
+			for (b = 0; b < ck->len; b++) {
+				if (svf_bit(ck->mask, b) &&
+				    (svf_bit(ck->buf, ck->offset + b) != svf_bit(ck->tdo, b)))
+					break;
+			}
+			pl->checks++;
+			if (b < ck->len) {
+				if (pl->in_loop) {
+					pl->loop_fail = 1;
+				} else {
+					printf("SVF line %u: TDO mismatch at bit %u\n", ck->line, b);
+					retval = -1;
+				}
+			}
+		}
+		free(ck->buf);
+	}
+	pl->nchecks = 0;
+	pl->ntdo = 0;
+
+	return retval;
+}
+
+/*
+ * svf_scan: queue a SIR or SDR with its header and trailer bits. The header
+ * goes out first. Only the scan bits are compared against TDO.
+ */
+static int svf_scan(struct svf_player *pl, unsigned char type, char *args)
+{
+	struct svf_vec *v = (type == JTAG_SIR_XFER) ? &pl->sir : &pl->sdr;
+	struct svf_vec *h = (type == JTAG_SIR_XFER) ? &pl->hir : &pl->hdr;
+	struct svf_vec *t = (type == JTAG_SIR_XFER) ? &pl->tir : &pl->tdr;
+	unsigned char end = (type == JTAG_SIR_XFER) ? pl->endir : pl->enddr;
+	struct svf_check *ck;
+	unsigned int len, words;
+	u32 *buf;
+
+	if (svf_vec_parse(pl, v, args) < 0)
+		return -1;
+
+	len = h->len + v->len + t->len;
+	if (len == 0)
+		return 0;
+	words = SVF_WORDS(len);
+	pl->scans++;
+
+	//an instruction only goes out once the checks before it passed
+	if ((type == JTAG_SIR_XFER) && pl->ntdo && (svf_flush(pl) < 0))
+		return -1;
+	if ((pl->nchecks == SVF_CHECK_MAX) && (svf_flush(pl) < 0))
+		return -1;
+
+	buf = calloc(1, (words + 2 * SVF_WORDS(v->len) + 1) * sizeof(u32));
+	if (!buf) {
+		printf("Out of memory for SVF scan of %u bits\n", len);
+		return -1;
+	}
+	if (h->len)
+		svf_bits_copy(buf, 0, h->tdi, h->len);
+	if (v->len)
+		svf_bits_copy(buf, h->len, v->tdi, v->len);
+	if (t->len)
+		svf_bits_copy(buf, h->len + v->len, t->tdi, t->len);
+
+	if (type == JTAG_SIR_XFER) {
+		u32 ir = buf[0];
+		int retval = 0;
+
+		if (len > 32) {
+			printf("SVF line %u: SIR of %u bits not supported\n", pl->line, len);
+			free(buf);
+			return -1;
+		}
+
+		if (!v->has_tdo) {
+			free(buf);
+			return ast_jtag_queue_sir(end, len, ir);
+		}
+
+		//SIR with a TDO check is done right away, the queue has no IR capture
+		if (ast_jtag_queue_flush() < 0) {
+			free(buf);
+			return -1;
+		}
+		if (ast_jtag_xfer(JTAG_SIR_XFER, JTAG_READ_WRITE_XFER, end, len, &ir) < 0) {
+			free(buf);
+			return -1;
+		}
+		buf[0] = ir;
+		pl->checks++;
+		for (len = 0; len < v->len; len++) {
+			if (svf_bit(v->mask, len) &&
+			    (svf_bit(buf, h->len + len) != svf_bit(v->tdo, len)))
+				break;
+		}
+		if (len < v->len) {
+			if (pl->in_loop) {
+				pl->loop_fail = 1;
+			} else {
+				printf("SVF line %u: SIR TDO mismatch at bit %u\n", pl->line, len);
+				retval = -1;
+			}
+		}
+		free(buf);
+
+		return retval;
+	}
+
+	if (!v->has_tdo) {
+		//nothing to compare, the buffer only has to live until the flush
+		ck = &pl->check[pl->nchecks++];
+		ck->buf = buf;
+		ck->len = 0;
+		return ast_jtag_queue_sdr(JTAG_WRITE_XFER, end, len, buf);
+	}
+
+	ck = &pl->check[pl->nchecks++];
+	ck->buf = buf;
+	ck->tdo = &buf[words];
+	ck->mask = &buf[words + SVF_WORDS(v->len)];
+	memcpy(ck->tdo, v->tdo, SVF_WORDS(v->len) * sizeof(u32));
+	memcpy(ck->mask, v->mask, SVF_WORDS(v->len) * sizeof(u32));
+	ck->offset = h->len;
+	ck->len = v->len;
+	ck->line = pl->line;
+	pl->ntdo++;
+
+	return ast_jtag_queue_sdr(JTAG_READ_WRITE_XFER, end, len, buf);
+}
+
+/*
+ * svf_runtest: RUNTEST [run_state] [run_count TCK|SCK] [min_time SEC
+ * [MAXIMUM max_time SEC]] [ENDSTATE end_state]. Clocks run in IDLE, the
+ * only run_state the controller has. The end state holds for the RUNTESTs
+ * after, a run_state without ENDSTATE is also the end state.
+ */
+static int svf_runtest(struct svf_player *pl, char *args)
+{
+	unsigned int tcks = 0, usec = 0;
+	int end = -1, run = -1, state, maximum = 0;
+	double val = -1, us;
+	char *tok, *endp;
+
+	while ((tok = svf_token(&args))) {
+		if (!strcmp(tok, "ENDSTATE")) {
+			tok = svf_token(&args);
+			end = tok ? svf_state(tok) : -1;
+			if (end < 0)
+				return -1;
+			continue;
+		}
+		if (!strcmp(tok, "MAXIMUM")) {
+			maximum = 1;
+			continue;
+		}
+		if (!strcmp(tok, "TCK") || !strcmp(tok, "SCK")) {
+			if (val < 0)
+				return -1;
+			tcks = (unsigned int) val;
+			val = -1;
+			continue;
+		}
+		if (!strcmp(tok, "SEC")) {
+			if (val < 0)
+				return -1;
+			if (!maximum) {
+				us = val * 1000000;
+				usec = (unsigned int) us;
+				if (usec < us)
+					usec++;
+			}
+			val = -1;
+			continue;
+		}
+
+		state = svf_state(tok);
+		if (state >= 0) {
+			if (state != JTAG_STATE_IDLE) {
+				printf("SVF line %u: RUNTEST in %s not supported\n", pl->line, tok);
+				return -1;
+			}
+			run = state;
+			continue;
+		}
+
+		val = strtod(tok, &endp);
+		if ((*endp != '\0') || (val < 0))
+			return -1;
+	}
+
+	if (end >= 0)
+		pl->runtest_end = end;
+	else if (run >= 0)
+		pl->runtest_end = run;
+	end = pl->runtest_end;
+
+	if (ast_jtag_queue_runtest(tcks, usec) < 0)
+		return -1;
+
+	if (end != JTAG_STATE_IDLE) {
+		if (svf_flush(pl) < 0)
+			return -1;
+		return ast_jtag_set_tap_state(end == JTAG_STATE_TLRESET, end);
+	}
+
+	return 0;
+}
+
+/*
+ * ENDIR/ENDDR: the controller ends a scan in IDLE or PAUSE, pause is
+ * IRPAUSE for ENDIR and DRPAUSE for ENDDR
+ */
+static int svf_end_state(struct svf_player *pl, unsigned char *end, int pause, char *args)
+{
+	char *tok = svf_token(&args);
+	int state = tok ? svf_state(tok) : -1;
+
+	if (state == JTAG_STATE_IDLE) {
+		*end = 0;
+	} else if (state == pause) {
+		*end = 1;
+	} else {
+		printf("SVF line %u: %s state %s not supported\n", pl->line,
+		       (pause == JTAG_STATE_PAUSEIR) ? "ENDIR" : "ENDDR", tok ? tok : "");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int svf_stmt(struct svf_player *pl)
+{
+	char *args = pl->stmt;
+	char *cmd, *tok;
+	int state = -1;
+	double hz;
+
+	cmd = svf_token(&args);
+	if (!cmd)
+		return 0;
+	pl->statements++;
+
+	if (!strcmp(cmd, "SIR")) {
+		return svf_scan(pl, JTAG_SIR_XFER, args);
+	} else if (!strcmp(cmd, "SDR")) {
+		return svf_scan(pl, JTAG_SDR_XFER, args);
+	} else if (!strcmp(cmd, "RUNTEST")) {
+		return svf_runtest(pl, args);
+	} else if (!strcmp(cmd, "HIR")) {
+		return svf_vec_parse(pl, &pl->hir, args);
+	} else if (!strcmp(cmd, "HDR")) {
+		return svf_vec_parse(pl, &pl->hdr, args);
+	} else if (!strcmp(cmd, "TIR")) {
+		return svf_vec_parse(pl, &pl->tir, args);
+	} else if (!strcmp(cmd, "TDR")) {
+		return svf_vec_parse(pl, &pl->tdr, args);
+	} else if (!strcmp(cmd, "ENDIR")) {
+		return svf_end_state(pl, &pl->endir, JTAG_STATE_PAUSEIR, args);
+	} else if (!strcmp(cmd, "ENDDR")) {
+		return svf_end_state(pl, &pl->enddr, JTAG_STATE_PAUSEDR, args);
+	} else if (!strcmp(cmd, "STATE")) {
+		//only the last state of the path matters to the controller
+		while ((tok = svf_token(&args))) {
+			state = svf_state(tok);
+			if (state < 0)
+				return -1;
+		}
+		if (state < 0)
+			return -1;
+		if (svf_flush(pl) < 0)
+			return -1;
+		return ast_jtag_set_tap_state(state == JTAG_STATE_TLRESET, state);
+	} else if (!strcmp(cmd, "FREQUENCY")) {
+		tok = svf_token(&args);
+		if (!tok)
+			return 0;
+		hz = strtod(tok, NULL);
+		if (svf_flush(pl) < 0)
+			return -1;
+		if (debug) printf("SVF FREQUENCY %.0f Hz\n", hz);
+		return ast_set_jtag_freq((unsigned int) hz);
+	} else if (!strcmp(cmd, "TRST")) {
+		//no TRST line on the controller
+		return 0;
+	} else if (!strcmp(cmd, "LOOP")) {
+		tok = svf_token(&args);
+		if (pl->in_loop || !tok || (atoi(tok) <= 0))
+			return -1;
+		if (svf_flush(pl) < 0)
+			return -1;
+		pl->in_loop = 1;
+		pl->loop_fail = 0;
+		pl->loop_count = atoi(tok);
+		pl->loop_iter = 0;
+		pl->loop_pos = pl->pos;
+		pl->loop_line = pl->line;
+		return 0;
+	} else if (!strcmp(cmd, "ENDLOOP")) {
+		if (!pl->in_loop)
+			return -1;
+		if (svf_flush(pl) < 0)
+			return -1;
+		if (!pl->loop_fail) {
+			pl->in_loop = 0;
+		} else if (++pl->loop_iter < pl->loop_count) {
+			pl->loop_fail = 0;
+			pl->pos = pl->loop_pos;
+			pl->line = pl->loop_line;
+		} else {
+			printf("SVF line %u: LOOP failed %u times\n", pl->line, pl->loop_count);
+			return -1;
+		}
+		return 0;
+	}
+
+	printf("SVF line %u: %s not supported\n", pl->line, cmd);
+
+	return -1;
+}
+
+/*
+ * svf_play: run an SVF file on the JTAG controller.
+ */
+int svf_play(const char *path)
+{
+	struct svf_player *pl;
+	struct timespec t0, t1;
+	struct stat st;
+	char *map;
+	int fd, retval = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+		return -1;
+	}
+
+	if ((fstat(fd, &st) == -1) || (st.st_size == 0)) {
+		fprintf(stderr, "Cannot read '%s'\n", path);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Cannot map '%s': %d, %s\n", path, errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	pl = calloc(1, sizeof(*pl));
+	if (pl)
+		pl->stmt = malloc(SVF_STMT_INIT);
+	if (!pl || !pl->stmt) {
+		printf("Out of memory for SVF player\n");
+		free(pl);
+		munmap(map, st.st_size);
+		close(fd);
+		return -1;
+	}
+	pl->map = map;
+	pl->size = st.st_size;
+	pl->runtest_end = JTAG_STATE_IDLE;
+	pl->line = 1;
+	pl->stmt_max = SVF_STMT_INIT;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (;;) {
+		retval = svf_read_stmt(pl);
+		if (retval <= 0)
+			break;
+		if (svf_stmt(pl) < 0) {
+			printf("SVF line %u: error in '%s'\n", pl->line, pl->stmt);
+			retval = -1;
+			break;
+		}
+	}
+
+	if (pl->in_loop && (retval == 0)) {
+		printf("SVF: LOOP without ENDLOOP\n");
+		retval = -1;
+	}
+	if (svf_flush(pl) < 0)
+		retval = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("SVF: %u statements, %u scans, %u TDO checks, %u flushes, %ld ms\n",
+	       pl->statements, pl->scans, pl->checks, pl->flushes,
+	       (long) ((t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000));
+
+	svf_vec_free(&pl->sir);
+	svf_vec_free(&pl->sdr);
+	svf_vec_free(&pl->hir);
+	svf_vec_free(&pl->hdr);
+	svf_vec_free(&pl->tir);
+	svf_vec_free(&pl->tdr);
+	free(pl->stmt);
+	free(pl);
+	munmap(map, st.st_size);
+	close(fd);
+
+	return retval;
+}
@@ -0,0 +1,139 @@
+/*
+ * jed_pack_fuses() and jed_row_cmp() against one character and one word at
+ * a time, on random '0'/'1'/CR/LF strings of odd lengths, offsets and fuse
+ * positions. Built once for the SSE2/NEON kernel of the target and once with
+ * JED_PACK_SCALAR for the 64-bit word kernel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast-jtag.h"
+#include "fuse-pack.h"
+
+#define TEST_ROUNDS		20000
+#define TEST_LEN_MAX		1000
+#define TEST_FUSES_MAX		(TEST_LEN_MAX + 64)
+#define TEST_WORDS		((TEST_FUSES_MAX + 31) / 32 + 1)
+
+static unsigned int test_seed = 1;
+
+static unsigned int test_rand(void)
+{
+	test_seed = test_seed * 1103515245 + 12345;
+	return test_seed >> 16;
+}
+
+/* ref_pack_fuses: jed_pack_fuses() one character at a time */
+static size_t ref_pack_fuses(const char *src, size_t len, u32 *dst,
+			     unsigned int *pos, unsigned int max, u32 *sum)
+{
+	unsigned int p = *pos;
+	size_t i;
+	char c;
+
+	for (i = 0; i < len; i++) {
+		c = src[i];
+		if ((c == '0') || (c == '1')) {
+			if (p == max)
+				break;
+			if (c == '1') {
+				if (dst)
+					dst[p >> 5] |= 1u << (p & 31);
+				*sum += 1u << (p & 7);
+			}
+			p++;
+		} else if ((c != '\r') && (c != '\n') && (c != ' ') && (c != '\t')) {
+			break;
+		}
+	}
+	*pos = p;
+
+	return i;
+}
+
+/* fill len characters, runs of fuses broken by line ends, maybe a '*' */
+static void test_fill(char *src, size_t len)
+{
+	static const char eol[] = "\r\n";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if ((test_rand() % 61) == 0)
+			src[i] = eol[test_rand() % 2];
+		else
+			src[i] = '0' + (test_rand() & 1);
+	}
+	if (len && ((test_rand() % 4) == 0))
+		src[test_rand() % len] = '*';
+}
+
+static int test_pack(int round)
+{
+	char buf[TEST_LEN_MAX + 16];
+	u32 dst[TEST_WORDS], ref[TEST_WORDS], sum = 0, ref_sum = 0;
+	unsigned int pos, ref_pos, max;
+	size_t len, n, ref_n;
+	char *src;
+
+	len = (test_rand() % (TEST_LEN_MAX / 2)) * 2 + 1;
+	src = buf + test_rand() % 16;
+	test_fill(src, len);
+	pos = test_rand() % 64;
+	max = pos + test_rand() % (TEST_FUSES_MAX - 64);
+	ref_pos = pos;
+
+	memset(dst, 0, sizeof(dst));
+	memset(ref, 0, sizeof(ref));
+	n = jed_pack_fuses(src, len, (round & 1) ? dst : NULL, &pos, max, &sum);
+	ref_n = ref_pack_fuses(src, len, (round & 1) ? ref : NULL, &ref_pos, max, &ref_sum);
+
+	if ((n != ref_n) || (pos != ref_pos) || (sum != ref_sum) || memcmp(dst, ref, sizeof(dst))) {
+		printf("round %d: %zu characters, max %u: consumed %zu/%zu, pos %u/%u, "
+		       "sum 0x%X/0x%X%s\n", round, len, max, n, ref_n, pos, ref_pos,
+		       sum, ref_sum, memcmp(dst, ref, sizeof(dst)) ? ", fuses differ" : "");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_cmp(int round)
+{
+	u32 a[TEST_WORDS], b[TEST_WORDS];
+	unsigned int i, words;
+	int ref = -1;
+
+	words = test_rand() % TEST_WORDS;
+	for (i = 0; i < words; i++)
+		a[i] = b[i] = test_rand() | (test_rand() << 16);
+	if (words && (test_rand() & 1)) {
+		i = test_rand() % words;
+		b[i] ^= 1u << (test_rand() % 32);
+		ref = i;
+	}
+
+	if (jed_row_cmp(a, b, words) != ref) {
+		printf("round %d: %u words, first difference %d, jed_row_cmp says %d\n",
+		       round, words, ref, jed_row_cmp(a, b, words));
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int i, errors = 0;
+
+	for (i = 0; i < TEST_ROUNDS; i++) {
+		if (test_pack(i) < 0)
+			errors++;
+		if (test_cmp(i) < 0)
+			errors++;
+	}
+
+	printf("fuse pack %s: %d rounds, %d errors\n", jed_pack_kernel(), TEST_ROUNDS, errors);
+
+	return errors ? 1 : 0;
+}
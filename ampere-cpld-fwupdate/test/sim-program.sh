@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Program, verify and read back a generated image on the MachXO2 simulator.
+# Any busy, run-test clock or FAIL error the simulator reports fails the test.
+#
+# usage: sim-program.sh <ampere-cpld-fwupdate>
+
+CPLD=$1
+ROWS=64
+
+if [ -z "$CPLD" ]; then
+	echo "usage: $0 <ampere-cpld-fwupdate>"
+	exit 1
+fi
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+# JEDEC file of ROWS pseudo random 128 bit rows, with its fuse checksum
+awk -v rows=$ROWS 'BEGIN {
+	printf "\002*\r\nNOTE DEVICE NAME:\tLCMXO2-4000HC-4TQFP144*\r\n"
+	printf "QF%d*\r\nG0*\r\nF0*\r\nL000000\r\n", rows * 128
+	x = 1; sum = 0
+	for (r = 0; r < rows; r++) {
+		line = ""
+		for (i = 0; i < 128; i++) {
+			x = (x * 1103515245 + 12345) % 2147483648
+			b = int(x / 65536) % 2
+			if (b)
+				sum += 2 ^ ((r * 128 + i) % 8)
+			line = line b
+		}
+		printf "%s\r\n", line
+	}
+	printf "*\r\nNOTE END CONFIG DATA*\r\n"
+	printf "C%04X*\r\nUH1234ABCD*\r\n\0030000\r\n", sum % 65536
+}' > "$DIR/image.jed"
+
+run() {
+	echo "== $*"
+	"$CPLD" -n "sim:$DIR/flash" "$@" > "$DIR/out" 2>&1
+	retval=$?
+	cat "$DIR/out"
+	if [ $retval -ne 0 ]; then
+		echo "FAIL: exit $retval"
+		exit 1
+	fi
+	if grep "^sim:" "$DIR/out" | grep -q " [1-9][0-9]* busy errors\| [1-9][0-9]* TCK errors\|FAIL set"; then
+		echo "FAIL: simulator errors"
+		exit 1
+	fi
+}
+
+run -p "$DIR/image.jed"
+run -v "$DIR/image.jed"
+run -r "$DIR/readback.jed"
+if ! grep -q "usercode 0x1234ABCD" "$DIR/out"; then
+	echo "FAIL: USERCODE"
+	exit 1
+fi
+run -v "$DIR/readback.jed"
+
+echo "PASS"
+exit 0